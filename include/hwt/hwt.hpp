@@ -19,20 +19,55 @@
 #ifndef _HWT_H
 #define _HWT_H
 
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <cmath>
 #include <functional>
+#include <vector>
+#include <utility>
+#include "hwt/hwtkernels.hpp"
 
 #define NDIMS 64
 #define LC 10
+#define NLEVELS 7    /* log2(NDIMS) + 1 */
+#define HWT_MAX_OPCOUNTS 4
 
 
 namespace hwt {
 
+	/** one thread's op counts, one slot per hwopcount_t, on a cache line of its own **/
+	struct alignas(64) hwopslots_t {
+		std::atomic<unsigned long> counts[HWT_MAX_OPCOUNTS];
+	};
+
+	/* this thread's slots, NULL until it first counts an op */
+	inline thread_local hwopslots_t *hwt_opslots = NULL;
+
+	/* allocate and register this thread's slots; at thread exit its counts
+	   are folded into the totals and the slots freed */
+	hwopslots_t* register_opslots();
+
+	/** op count kept per thread and summed on read, so that threads counting
+	    concurrently don't contend on one cache line.  Set it only while no
+	    thread is counting **/
+	class hwopcount_t {
+	private:
+		int m_index;
+	public:
+		hwopcount_t();
+		void Add(const unsigned long n = 1){
+			hwopslots_t *slots = (hwt_opslots) ? hwt_opslots : register_opslots();
+			std::atomic<unsigned long> &count = slots->counts[m_index];
+			count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+		operator unsigned long()const;
+		hwopcount_t& operator=(const unsigned long n);
+	};
+
 	/** datapoint element  **/
 	struct hc_t {
-		static unsigned long n_query_ops;
+		static hwopcount_t n_query_ops;
 		long long id;
 		uint64_t code;
 		hc_t():id(0),code(0){}
@@ -50,18 +85,18 @@ namespace hwt {
 			return (id == other.id && code == other.code);
 		}
 		int distance(const hc_t other)const{
-			return __builtin_popcountll(code^other.code);
+			return hwt_kernels->distance(code, other.code);
 		}
 		int distance(const uint64_t other)const {
-			hc_t::n_query_ops++;
-		return __builtin_popcountll(code^other);
+			hc_t::n_query_ops.Add();
+		return hwt_kernels->distance(code, other);
 	}
 };
 
 
 	/** hamming weights data type **/
 	struct hw_t {
-		static unsigned long n_build_ops;
+		static hwopcount_t n_build_ops;
 		uint8_t wts[NDIMS];
 		hw_t(){
 			for (int i=0;i<NDIMS;i++)
@@ -80,14 +115,11 @@ namespace hwt {
 			return !memcmp(wts, other.wts, NDIMS);
 		}
 		int l1distance(const hw_t &other)const{
-			hw_t::n_build_ops++;
-			int sum = 0;
-			for (int i=0;i < NDIMS;i++)
-				sum += abs((int)wts[i] - (int)other.wts[i]);
-			return sum;
+			hw_t::n_build_ops.Add();
+			return hwt_kernels->l1distance(wts, other.wts);
 		}
 		int l2distance(const hw_t &other)const{
-			hw_t::n_build_ops++;
+			hw_t::n_build_ops.Add();
 			int sum = 0;
 			for (int i=0;i < NDIMS;i++)
 				sum += pow((int)wts[i] - (int)other.wts[i], 2.0);
@@ -98,6 +130,65 @@ namespace hwt {
 		}
 	};
 
+	/** weight pyramid: packed segment weights of a code for every level.
+	    lanes[l] holds the 2^l weights of level l, NDIMS/2^l bits each, with
+	    each level the pairwise sums of the next finer one **/
+	struct hwpyramid_t {
+		uint64_t lanes[NLEVELS];
+		hwpyramid_t(const uint64_t code);
+		/* unpack one level into hw_t, same as calc_hwts */
+		void Level(const int level, hw_t &wts)const;
+	};
+
+	/** bit summary of a set of codes: bits set in all codes, bits set in any code,
+	    and bit (tenant % 64) set for the tenant tag of each code **/
+	struct hwsum_t {
+		uint64_t andbits;
+		uint64_t orbits;
+		uint64_t tenants;
+		hwsum_t():andbits(0xffffffffffffffffULL),orbits(0),tenants(0){}
+		void Add(const uint64_t code, const uint32_t tenant = 0){
+			andbits &= code;
+			orbits |= code;
+			tenants |= 0x01ULL << (tenant % 64);
+		}
+		void Add(const hwsum_t &other){
+			andbits &= other.andbits;
+			orbits |= other.orbits;
+			tenants |= other.tenants;
+		}
+		/* lower bound on hamming distance from target to any code in the set */
+		int distance(const uint64_t target)const{
+			return __builtin_popcountll(andbits & ~target) + __builtin_popcountll(~orbits & target);
+		}
+		/* lower bound on hamming distance between any two codes of the two sets */
+		int distance(const hwsum_t &other)const{
+			return __builtin_popcountll(andbits & ~other.orbits) + __builtin_popcountll(other.andbits & ~orbits);
+		}
+	};
+
+	/** search filter: only entries of one tenant, and/or only ids allowed by
+	    a bitmap (bit id of idmap), or not in it when blocklist is set **/
+	struct hwfilter_t {
+		bool by_tenant;
+		uint32_t tenant;
+		const std::vector<uint64_t> *idmap;
+		bool blocklist;
+		hwfilter_t():by_tenant(false),tenant(0),idmap(NULL),blocklist(false){}
+		hwfilter_t(const uint32_t tenant):by_tenant(true),tenant(tenant),idmap(NULL),blocklist(false){}
+		/* tenant bits a subtree's summary must share to hold a match */
+		uint64_t TenantMask()const{
+			return by_tenant ? 0x01ULL << (tenant % 64) : 0xffffffffffffffffULL;
+		}
+		bool Accept(const long long id, const uint32_t t)const{
+			if (by_tenant && t != tenant) return false;
+			if (idmap == NULL) return true;
+			size_t word = (size_t)((unsigned long long)id/64);
+			bool found = word < idmap->size() && ((*idmap)[word] >> ((unsigned long long)id % 64) & 0x01ULL);
+			return found != blocklist;
+		}
+	};
+
 	/* hasher functional to hash hw_t keys */
 	struct hwhasher_t{
 		size_t operator()(const hw_t &key) const{
@@ -114,6 +205,18 @@ namespace hwt {
 	/** calc hamming weights for hw_t  **/
 	void calc_hwts(struct hw_t &hwts, const uint64_t code, const int level);
 
+	/** scan n contiguous codes, append positions of those within radius of target **/
+	void scan_codes(const uint64_t *codes, const size_t n, const uint64_t target, const int radius,
+					std::vector<size_t> &positions);
+
+	/** compare all codes a[i] against all codes b[j] in blocks, append (i, j) of pairs within radius **/
+	void join_codes(const uint64_t *a, const size_t na, const uint64_t *b, const size_t nb, const int radius,
+					std::vector<std::pair<size_t,size_t>> &pairs);
+
+	/** join_codes of a against itself, each pair once: append (i, j), i < j, of pairs within radius **/
+	void self_join_codes(const uint64_t *a, const size_t n, const int radius,
+						 std::vector<std::pair<size_t,size_t>> &pairs);
+
 }
 
 #endif /* _HWT_H */
@@ -0,0 +1,87 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#ifndef _HWTCURSOR_H
+#define _HWTCURSOR_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <queue>
+#include <memory>
+#include "hwt/hwtree.hpp"
+
+namespace hwt {
+
+	/**
+	 * resumable search from one target, returning entries in non-decreasing
+	 * hamming distance a page at a time.  The frontier of unexpanded nodes and
+	 * unreturned entries is kept between calls, ordered by lower bound, so
+	 * paging out to a radius does the work of one RangeSearch at that radius.
+	 * An ordered leaf's key bands, like its nodes, are only ranked once their
+	 * bound comes up.
+	 * Searches a snapshot: later changes to the tree are not seen.
+	 **/
+	class HWTCursor {
+	private:
+
+		/* a node w/ a lower bound on its codes' distances, or an entry w/ its
+		   distance; a leaf w/ last > 0 stands for its band [first, last) */
+		struct item_t {
+			int bound;
+			HWTNode *node;
+			int level;
+			hc_t entry;
+			size_t first;
+			size_t last;
+			/* least bound on top, entries before nodes of equal bound */
+			bool operator<(const item_t &other)const{
+				if (bound != other.bound) return bound > other.bound;
+				return node != NULL && other.node == NULL;
+			}
+		};
+
+		std::shared_ptr<const HWTree> m_snapshot;
+
+		std::uint64_t m_target;
+
+		hw_t m_wts[NLEVELS];
+
+		std::priority_queue<item_t> m_frontier;
+
+		/* replace the node on top w/ its children, a leaf w/ its tail entries
+		   and key bands, or a band w/ its entries */
+		void ExpandTop();
+
+	public:
+		HWTCursor(std::shared_ptr<const HWTree> snapshot, const std::uint64_t target);
+
+		/* next n entries, or fewer once the snapshot is exhausted */
+		std::vector<hc_t> Next(const std::size_t n);
+
+		/* all entries not yet returned w/in radius */
+		std::vector<hc_t> NextWithin(const int radius);
+
+		/* lower bound on the distance of the next entry, -1 when exhausted */
+		int Bound()const;
+
+		std::size_t FrontierSize()const;
+	};
+}
+
+#endif /* _HWTCURSOR_H */
@@ -0,0 +1,64 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#ifndef _HWTKERNELS_H
+#define _HWTKERNELS_H
+
+#include <cstdlib>
+#include <cstdint>
+
+namespace hwt {
+
+	/* instruction set variants of the distance kernels, slowest first */
+	enum hwtisa_t {
+		ISA_SCALAR,      /* portable, no popcount instruction */
+		ISA_POPCNT,      /* x86 popcnt */
+		ISA_AVX2,        /* 4 codes per step, nibble lookup popcount */
+		ISA_AVX512,      /* 8 codes per step, AVX-512BW nibble lookup */
+		ISA_VPOPCNT,     /* 8 codes per step, AVX-512 VPOPCNTDQ */
+		ISA_AUTO         /* best supported by this cpu */
+	};
+
+	/** one variant's kernels **/
+	struct hwtkernels_t {
+		hwtisa_t isa;
+		const char *name;
+		/* dists[i] = hamming distance of codes[i*stride] to target, i < n */
+		void (*distances)(const uint64_t *codes, const size_t stride, const size_t n,
+						  const uint64_t target, uint8_t *dists);
+		/* sum of absolute differences of two arrays of NDIMS weights */
+		int (*l1distance)(const uint8_t *a, const uint8_t *b);
+		/* hamming distance of two codes */
+		int (*distance)(const uint64_t a, const uint64_t b);
+	};
+
+	/* kernels in use; scalar until the best variant is selected at startup */
+	extern const hwtkernels_t *hwt_kernels;
+
+	/* can this cpu run the isa's kernels */
+	bool isa_supported(const hwtisa_t isa);
+
+	/* use isa's kernels from now on, false if unsupported.  Not thread-safe
+	   w/ concurrent searches.  At startup the HWT_ISA environment variable
+	   (scalar, popcnt, avx2, avx512, vpopcnt) overrides ISA_AUTO */
+	bool select_isa(const hwtisa_t isa);
+
+	const char* isa_name(const hwtisa_t isa);
+}
+
+#endif /* _HWTKERNELS_H */
@@ -0,0 +1,116 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#ifndef _HWTLOG_H
+#define _HWTLOG_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include "hwt/hwt.hpp"
+
+#define LOG_INSERT 1
+#define LOG_DELETE 2
+
+namespace hwt {
+
+	/* when the log forces its writes to disk */
+	enum hwtsync_t {
+		SYNC_NONE,      /* leave it to the OS */
+		SYNC_COMMIT,    /* fdatasync every group commit */
+		SYNC_INTERVAL   /* fdatasync at most once per interval */
+	};
+
+	/** log record: one Insert or Delete **/
+	struct hwtrecord_t {
+		uint64_t lsn;
+		long long id;
+		uint64_t code;
+		uint32_t op;
+		uint32_t tenant;
+		uint32_t check;
+	};
+
+	/**
+	 * append-only mutation log.  Records are buffered and written in groups
+	 * of groupsize (or on Commit) w/ a single sequential write; durability of
+	 * a group then depends on the sync policy.  Every record carries a log
+	 * sequence number (lsn) so that replay after a snapshot is idempotent.
+	 * A torn tail left by a crash is detected by checksum and discarded.
+	 * The file starts w/ a format header; files of another format are
+	 * rejected rather than read as torn.
+	 **/
+	class HWTLog {
+	private:
+
+		int m_fd;
+
+		std::string m_path;
+
+		hwtsync_t m_policy;
+
+		size_t m_groupsize;
+
+		std::chrono::milliseconds m_interval;
+
+		std::chrono::steady_clock::time_point m_lastsync;
+
+		std::vector<hwtrecord_t> m_pending;
+
+		uint64_t m_lsn;
+
+		void Write(const void *buf, const size_t nbytes);
+
+	public:
+		HWTLog(const std::string &path, const hwtsync_t policy = SYNC_COMMIT,
+			   const size_t groupsize = 1024, const int interval_ms = 100);
+
+		~HWTLog();
+
+		/* buffer a record, commits the group when full; returns its lsn */
+		uint64_t Append(const uint32_t op, const hc_t &e, const uint32_t tenant = 0);
+
+		/* write all buffered records, sync per policy */
+		void Commit();
+
+		/* write all buffered records and force them to disk */
+		void Sync();
+
+		/* discard all records, e.g. once a snapshot covers them */
+		void Truncate();
+
+		/* apply records w/ lsn > after in batches of up to batchsize; returns no. applied */
+		size_t Replay(const uint64_t after, std::function<void(const std::vector<hwtrecord_t>&)> apply,
+					  const size_t batchsize = 4096);
+
+		uint64_t LastLSN()const;
+	};
+
+	/** write entries and their tenant tags (parallel, or empty for tenant 0)
+	    w/ the lsn they include to path, atomically replacing it **/
+	void write_snapshot(const std::string &path, const uint64_t lsn, const std::vector<hc_t> &entries,
+						const std::vector<uint32_t> &tenants);
+
+	/** read snapshot at path into entries and tenants, returns its lsn (0 if no snapshot) **/
+	uint64_t read_snapshot(const std::string &path, std::vector<hc_t> &entries, std::vector<uint32_t> &tenants);
+}
+
+#endif /* _HWTLOG_H */
@@ -23,40 +23,173 @@
 #include <unordered_map>
 #include <vector>
 #include <queue>
+#include <atomic>
 #include "hwt/hwt.hpp"
 
+/* leaves this size or larger keep their entries ordered by weight key */
+#define LEAF_ORDER_SIZE 64
+
 
 namespace hwt {
-	
+
+	class HWTNode;
+
+	/* child node reference w/ summary of the codes beneath it */
+	struct hwchild_t {
+		HWTNode *node;
+		hwsum_t sum;
+		bool stale;
+		hwchild_t():node(NULL),stale(false){}
+	};
+
+	typedef std::unordered_map<hw_t, hwchild_t, hwhasher_t> hwchildmap_t;
+
+	/* ordered leaf entries [first, last) of one weight key, w/ a lower bound
+	   on their distance to a target */
+	struct hwband_t {
+		size_t first;
+		size_t last;
+		int bound;
+	};
+
+	/* a batch entry's pyramid and its position in the batch */
+	struct hwbatchitem_t {
+		hwpyramid_t pyramid;
+		size_t pos;
+		hwbatchitem_t(const uint64_t code, const size_t pos):pyramid(code),pos(pos){}
+	};
+
+	/**
+	 * entries added in one pass, w/ the pyramid of each computed once.  Items
+	 * are in batch order, by their lanes coarsest first: codes w/ equal keys
+	 * at a level have equal keys at all coarser ones, so at every node the
+	 * items for each child already form one contiguous subrange.
+	 **/
+	struct hwbatch_t {
+		const hc_t *entries;
+		const uint32_t *tenants;    /* parallel to entries, NULL for tenant 0 */
+		std::vector<hwbatchitem_t> items;
+		/* no items yet, for the caller to fill in */
+		hwbatch_t(const hc_t *entries, const uint32_t *tenants):entries(entries),tenants(tenants){}
+		hwbatch_t(const hc_t *entries, const uint32_t *tenants, const size_t n);
+		/* whether item a comes before item b in batch order */
+		static bool Before(const hwbatchitem_t &a, const hwbatchitem_t &b);
+		uint32_t Tenant(const size_t pos)const{ return (tenants) ? tenants[pos] : 0; }
+	};
+
+	/**
+	 * nodes are reference counted and shared between a tree and its snapshots.
+	 * A node is only modified while unshared; mutations path-copy shared nodes
+	 * w/ Unshare on the way down from the top.
+	 **/
 	class HWTNode {
 	private:
+
+		std::atomic<int> m_refs;
+
 	public:
+		/* entries read to recompute summaries */
+		static hwopcount_t n_summary_ops;
+
+		HWTNode():m_refs(1){}
+		HWTNode(const HWTNode &other):m_refs(1){}
 		virtual ~HWTNode(){}
-		virtual HWTNode* AddEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level) = 0;
-		virtual HWTNode* DelEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level) = 0;
+
+		void Ref();
+		bool Shared()const;
+		/* drop a reference, deleting nodes no longer referenced */
+		static void Release(HWTNode *node);
+		/* node itself if unshared, else a private copy in its place */
+		static HWTNode* Unshare(HWTNode *node);
+		/* shallow copy: children are shared w/ the copy */
+		virtual HWTNode* Clone()const = 0;
+
+		/* level is the node's own; an internal node sets next to the child on
+		   entry's path, which is at level + Skip() + 1 */
+		virtual HWTNode* AddEntry(const hc_t &entry, const uint32_t tenant, const hwpyramid_t &pyramid,
+								  HWTNode **next, int level) = 0;
+		virtual HWTNode* DelEntry(const hc_t &entry, const hwpyramid_t &pyramid, HWTNode **next, int level) = 0;
+		/* add entries to this subtree, tenants parallel to entries or empty for
+		   tenant 0; returns the node replacing this one */
+		HWTNode* AddEntries(const std::vector<hc_t> &entries, const std::vector<uint32_t> &tenants,
+							const int level);
+		/* AddEntries of the batch entries in items[first, last), which share
+		   their keys at the levels above this node */
+		virtual HWTNode* AddBatch(hwbatch_t &batch, const size_t first, const size_t last, const int level) = 0;
+		/* move other's subtree into this one, consuming other; returns the node
+		   replacing this one */
+		virtual HWTNode* Merge(HWTNode *other, const int level) = 0;
 		virtual void SetChildNode(const hw_t &key, HWTNode *node) = 0;
 		virtual void UnsetChildNode(const hw_t &key) = 0;
+		virtual void Summarize(hwsum_t &sum)const = 0;
+		/* Summarize, storing the summaries it recomputes for stale children
+		   so each is recomputed once; node must be unshared */
+		virtual void Refresh(hwsum_t &sum) = 0;
+		virtual void Prefetch()const = 0;
 		virtual size_t BytesUsed()const=0;
 		virtual bool IsLeaf()const = 0;
 	};
 
+	/**
+	 * an internal node at level keys its children by their level weights.  A
+	 * run of levels where all codes beneath share one key is collapsed into
+	 * the node rather than kept as a chain of single-child nodes: the node then
+	 * keys its children at level + m_skip, and m_code, any code beneath it,
+	 * gives the shared keys of the skipped levels.
+	 **/
 	class HWTInternal : public HWTNode {
 	private:
 	
-		std::unordered_map<hw_t, HWTNode*, hwhasher_t> m_childnodes;
+		hwchildmap_t m_childnodes;
+
+		int m_skip;
+
+		uint64_t m_code;
+
+		/* collapse the levels all batch entries in items[first, last) share,
+		   for a node w/o children */
+		void Compress(const hwbatch_t &batch, const size_t first, const size_t last, const int level);
+
+		/* cut the collapsed levels back to skip, those below go to a new child */
+		void Expand(const int skip, const int level);
+
+		/* first level at which a code's key leaves the shared keys, level + m_skip if none */
+		int Mismatch(const hwpyramid_t &pyramid, const int level)const;
+		/* same, w/ shared the pyramid of m_code */
+		int Mismatch(const hwpyramid_t &pyramid, const hwpyramid_t &shared, const int level)const;
 	
 	public:
-		HWTInternal(){};
+		HWTInternal():m_skip(0),m_code(0){};
 		~HWTInternal(){}
-		HWTNode* AddEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level);
-		HWTNode* DelEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level);
+		HWTNode* Clone()const;
+		HWTNode* AddEntry(const hc_t &entry, const uint32_t tenant, const hwpyramid_t &pyramid,
+						  HWTNode **next, int level);
+		HWTNode* DelEntry(const hc_t &entry, const hwpyramid_t &pyramid, HWTNode **next, int level);
 		void SetChildNode(const hw_t &key, HWTNode *node);
 		void UnsetChildNode(const hw_t &key);
-		void AddEntries(std::vector<hc_t> &entries, const int level);
+		HWTNode* AddBatch(hwbatch_t &batch, const size_t first, const size_t last, const int level);
+		HWTNode* Merge(HWTNode *other, const int level);
 	
 		void GetChildNodes(std::queue<HWTNode*> &nodes);
+
+		const hwchildmap_t& GetChildMap()const;
+
+		/* number of levels collapsed into this node */
+		int Skip()const;
+
+		/* key shared by all codes beneath at a level below level + Skip() */
+		void SharedKey(const int level, hw_t &wts)const;
+
+		/* false if the shared keys already put all codes beneath out of radius
+		   of a target w/ weights wts[0..NLEVELS) */
+		bool PrefixWithin(const hw_t *wts, const int radius, const int level)const;
 	
-		void SelectChildNodes(const hw_t &wts, const int radius, std::queue<HWTNode*> &next_nodes, int level);
+		/* children possibly holding codes within radius, of tenants in mask */
+		void SelectChildNodes(const hw_t &wts, const uint64_t target, const int radius,
+							  const uint64_t tenants, std::vector<HWTNode*> &next_nodes);
+		void Summarize(hwsum_t &sum)const;
+		void Refresh(hwsum_t &sum);
+		void Prefetch()const;
 		size_t BytesUsed()const;
 		bool IsLeaf()const;
 };
@@ -65,18 +198,50 @@ namespace hwt {
 	private:
 		
 		std::vector<hc_t> m_entries;
+
+		/* weight keys of m_entries[0..m_nordered), in ascending order; entries
+		   past that are an unordered tail, merged in once it grows too long */
+		std::vector<uint16_t> m_keys;
+
+		/* tenant tags parallel to m_entries; empty until a nonzero tag is added */
+		std::vector<uint32_t> m_tenants;
+
+		size_t m_nordered;
+
+		void Order();
+
+		/* entries in [first, last) within radius of target that pass filter */
+		void SelectRange(const size_t first, const size_t last, const uint64_t target, const int radius,
+						 const hwfilter_t &filter, std::vector<hc_t> &results)const;
 	
 	public:   
-		HWTLeaf(){};
+		HWTLeaf():m_nordered(0){};
 		~HWTLeaf(){}
-		HWTNode* AddEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level);
-		HWTNode* DelEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level);
+		HWTNode* Clone()const;
+		HWTNode* AddEntry(const hc_t &entry, const uint32_t tenant, const hwpyramid_t &pyramid,
+						  HWTNode **next, int level);
+		HWTNode* DelEntry(const hc_t &entry, const hwpyramid_t &pyramid, HWTNode **next, int level);
+		HWTNode* AddBatch(hwbatch_t &batch, const size_t first, const size_t last, const int level);
+		HWTNode* Merge(HWTNode *other, const int level);
 		void SetChildNode(const hw_t &key, HWTNode *node){}
 		void UnsetChildNode(const hw_t &key){};
 	
 		void Process(std::queue<HWTNode*> &nodes);
 		void GetEntries(std::vector<hc_t> &entries);
+		void GetEntries(std::vector<hc_t> &entries, std::vector<uint32_t> &tenants)const;
 		void SelectEntries(const uint64_t target, const int radius, std::vector<hc_t> &results);
+		void SelectEntries(const uint64_t target, const int radius, const hwfilter_t &filter,
+						   std::vector<hc_t> &results);
+		/* no. entries in the ordered prefix, the rest are an unordered tail */
+		size_t Ordered()const;
+		/* the ordered prefix split into bands of equal key */
+		void GetBands(const uint64_t target, std::vector<hwband_t> &bands)const;
+		/* entries in [first, last) w/ their distances to target */
+		void RankRange(const size_t first, const size_t last, const uint64_t target,
+					   std::vector<std::pair<int, hc_t>> &ranked)const;
+		void Summarize(hwsum_t &sum)const;
+		void Refresh(hwsum_t &sum);
+		void Prefetch()const;
 		size_t Size()const;
 		size_t BytesUsed()const;
 		bool IsLeaf()const;
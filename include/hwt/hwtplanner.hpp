@@ -0,0 +1,81 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#ifndef _HWTPLANNER_H
+#define _HWTPLANNER_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "hwt/hwt.hpp"
+
+namespace hwt {
+
+	/**
+	 * query planner for HWTree: keeps every code in a flat array alongside
+	 * histograms of the level-1 (halves) and level-2 (quarters) weight keys.
+	 * The histograms estimate the fraction of the index whose keys fall
+	 * within a query radius; above the threshold a linear scan of the flat
+	 * array is cheaper than traversing the tree.
+	 **/
+	class HWTPlanner {
+	private:
+
+		double m_threshold;
+
+		std::vector<uint64_t> m_codes;
+
+		std::vector<long long> m_ids;
+
+		std::unordered_multimap<long long, size_t> m_positions;
+
+		std::vector<uint32_t> m_level1;
+
+		std::vector<uint32_t> m_level2;
+
+		static int Level1Index(const uint64_t code);
+
+		static int Level2Index(const uint64_t code);
+
+	public:
+		/* threshold - estimated fraction of index above which queries scan */
+		HWTPlanner(const double threshold);
+
+		void Add(const hc_t &e);
+
+		void Remove(const hc_t &e);
+
+		/* estimated fraction of the index w/ level-1, level-2 keys within radius */
+		double EstimateLevel1(const uint64_t target, const int radius)const;
+
+		double EstimateLevel2(const uint64_t target, const int radius)const;
+
+		bool PreferScan(const uint64_t target, const int radius)const;
+
+		std::vector<hc_t> Scan(const uint64_t target, const int radius)const;
+
+		size_t Size()const;
+
+		size_t BytesUsed()const;
+
+		void Clear();
+	};
+}
+
+#endif /* _HWTPLANNER_H */
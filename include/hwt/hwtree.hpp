@@ -23,34 +23,112 @@
 #include <cstdlib>
 #include <cstdint>
 #include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <span>
 #include "hwt/hwtnode.hpp"
+#include "hwt/hwtplanner.hpp"
+#include "hwt/hwtlog.hpp"
 #include "hwt/hwt.hpp"
 
+/* no. queries in flight for RangeSearchBatch */
+#define INTERLEAVE_WIDTH 16
+
+/* default est. fraction of the index above which a flat scan beats traversal */
+#define SCAN_THRESHOLD 0.03
+
 namespace hwt {
 
+	class HWTCursor;
+
 	class HWTree {
 	private:
+
+		friend class HWTCursor;
 		
 		HWTNode *m_top;
+
+		HWTPlanner *m_planner;
+
+		HWTLog *m_log;
 	
 	public:
 		HWTree();
 
 		~HWTree();
 		
-		void Insert(const hc_t &e);
+		/* tenant tags the entry for filtered searches; tags are kept by the
+		   log, checkpoints and snapshots */
+		void Insert(const hc_t &e, const std::uint32_t tenant = 0);
 	
+		/* Insert of many entries in one pass, tenants parallel to entries or
+		   empty for tenant 0: entries are grouped by key at each level, so each
+		   node on their paths is visited, and each leaf grown and split, once
+		   per batch */
+		void InsertBatch(std::span<const hc_t> entries, std::span<const std::uint32_t> tenants = {});
+
 		void Delete(const hc_t &e);
+
+		/* move all of other's entries into this tree, grafting whole subtrees
+		   where this tree has no node for their key; other is left empty */
+		void Merge(HWTree &&other);
 		
 		std::vector<hc_t> RangeSearch(const std::uint64_t target, const int radius)const;
+
+		/* RangeSearch for entries passing filter; subtrees holding no entry of
+		   the filter's tenant are skipped.  Always walks the tree */
+		std::vector<hc_t> RangeSearch(const std::uint64_t target, const int radius,
+									  const hwfilter_t &filter)const;
+
+		/* same results as RangeSearch for each target; interleaves the traversals,
+		   prefetching one query's next node while working on another's */
+		std::vector<std::vector<hc_t>> RangeSearchBatch(const std::vector<std::uint64_t> &targets,
+														const int radius)const;
 	
+		/* report every pair of entries within radius of each other once; pairs
+		   of top-level subtrees are joined on n_threads threads (0 for one per
+		   core), so callback must be thread-safe */
+		void SelfJoin(const int radius, std::function<void(const hc_t&, const hc_t&)> callback,
+					  const int n_threads = 0)const;
+
+		/* report every pair (a, b), a in this tree and b in other, within radius;
+		   walks both trees in lockstep, threaded like SelfJoin */
+		void Join(const HWTree &other, const int radius,
+				  std::function<void(const hc_t&, const hc_t&)> callback, const int n_threads = 0)const;
+
 		const std::size_t Size()const;
+
+		void GetEntries(std::vector<hc_t> &entries)const;
+
+		/* entries w/ their tenant tags, parallel */
+		void GetEntries(std::vector<hc_t> &entries, std::vector<std::uint32_t> &tenants)const;
 	
 		const std::size_t MemoryUsage()const;
 		
 		void Clear();
 
+		/* read-only view of the tree as of now, sharing its nodes; later
+		   mutations copy the nodes they touch, so the snapshot can be searched
+		   from other threads while this tree is modified.  Take it on the
+		   thread that modifies the tree.  No planner or log. */
+		std::shared_ptr<const HWTree> Snapshot()const;
+
 		void Print(std::ostream &ostrm)const;
+
+		/* keep a flat code array and choose tree traversal or scan per query */
+		void EnablePlanner(const double threshold = SCAN_THRESHOLD);
+
+		void DisablePlanner();
+
+		/* append every Insert/Delete to log (not owned), NULL to detach */
+		void AttachLog(HWTLog *log);
+
+		/* snapshot all entries to path, then truncate the attached log */
+		void Checkpoint(const std::string &path);
+
+		/* reload snapshot at path and replay the attached log's tail */
+		void Recover(const std::string &path);
 	
 	};
 }
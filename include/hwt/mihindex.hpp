@@ -0,0 +1,73 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#ifndef _MIHINDEX_H
+#define _MIHINDEX_H
+
+#include <ostream>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "hwt/hwt.hpp"
+
+namespace hwt {
+
+	/**
+	 * multi-index hashing: the code is split into m disjoint substrings, each
+	 * indexed in its own hash table.  Any code within radius r of a target
+	 * matches the target within floor(r/m) bits on at least one substring,
+	 * so a range search only probes those substring neighborhoods.  Best
+	 * suited to small radii; same interface as HWTree.
+	 **/
+	class MIHIndex {
+	private:
+
+		int m_nsubs;
+
+		int m_subbits;
+
+		uint64_t m_submask;
+
+		std::vector<std::unordered_map<uint64_t, std::vector<hc_t>>> m_tables;
+
+		uint64_t Substring(const uint64_t code, const int i)const;
+
+	public:
+		/* nsubs - number of substrings, one of 2, 4, 8 or 16 */
+		MIHIndex(const int nsubs = 4);
+
+		~MIHIndex();
+
+		void Insert(const hc_t &e);
+
+		void Delete(const hc_t &e);
+
+		std::vector<hc_t> RangeSearch(const std::uint64_t target, const int radius)const;
+
+		const std::size_t Size()const;
+
+		const std::size_t MemoryUsage()const;
+
+		void Clear();
+
+		void Print(std::ostream &ostrm)const;
+	};
+}
+
+#endif /* _MIHINDEX_H */
@@ -17,37 +17,179 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
 
 #include <cmath>
+#include <mutex>
+#include <algorithm>
 #include "hwt/hwt.hpp"
 
+using namespace std;
 
-unsigned long hwt::hc_t::n_query_ops = 0;
+/* slots of live threads, and the counts of exited ones */
+struct hwopregistry_t {
+	mutex lock;
+	vector<hwt::hwopslots_t*> slots;
+	unsigned long retired[HWT_MAX_OPCOUNTS] = {};
+};
 
-unsigned long hwt::hw_t::n_build_ops = 0;
+/* never freed, so threads exiting after static destruction still find it */
+static hwopregistry_t& opregistry(){
+	static hwopregistry_t *registry = new hwopregistry_t();
+	return *registry;
+}
+
+/* frees the slots of the thread that registered them when it exits */
+struct hwopslots_owner_t {
+	~hwopslots_owner_t(){
+		if (hwt::hwt_opslots == NULL) return;
+		hwopregistry_t &registry = opregistry();
+		lock_guard<mutex> guard(registry.lock);
+		for (int i=0;i < HWT_MAX_OPCOUNTS;i++){
+			registry.retired[i] += hwt::hwt_opslots->counts[i].load(memory_order_relaxed);
+		}
+		registry.slots.erase(find(registry.slots.begin(), registry.slots.end(), hwt::hwt_opslots));
+		delete hwt::hwt_opslots;
+		hwt::hwt_opslots = NULL;
+	}
+};
+
+static atomic<int> n_opcounts(0);
+
+hwt::hwopslots_t* hwt::register_opslots(){
+	static thread_local hwopslots_owner_t owner;
+	(void)owner;
+
+	hwopslots_t *slots = new hwopslots_t();
+	for (int i=0;i < HWT_MAX_OPCOUNTS;i++){
+		slots->counts[i].store(0, memory_order_relaxed);
+	}
+	hwopregistry_t &registry = opregistry();
+	lock_guard<mutex> guard(registry.lock);
+	registry.slots.push_back(slots);
+	hwt_opslots = slots;
+	return slots;
+}
+
+hwt::hwopcount_t::hwopcount_t():m_index(n_opcounts++){}
+
+hwt::hwopcount_t::operator unsigned long()const{
+	hwopregistry_t &registry = opregistry();
+	lock_guard<mutex> guard(registry.lock);
+	unsigned long total = registry.retired[m_index];
+	for (hwopslots_t *slots : registry.slots){
+		total += slots->counts[m_index].load(memory_order_relaxed);
+	}
+	return total;
+}
+
+hwt::hwopcount_t& hwt::hwopcount_t::operator=(const unsigned long n){
+	hwopregistry_t &registry = opregistry();
+	lock_guard<mutex> guard(registry.lock);
+	registry.retired[m_index] = n;
+	for (hwopslots_t *slots : registry.slots){
+		slots->counts[m_index].store(0, memory_order_relaxed);
+	}
+	return *this;
+}
+
+hwt::hwopcount_t hwt::hc_t::n_query_ops;
+
+hwt::hwopcount_t hwt::hw_t::n_build_ops;
+
+/* sum adjacent fields of width bits into fields of twice the width */
+static inline uint64_t pairwise_sums(const uint64_t lane, const int width, const uint64_t mask){
+	return (lane & mask) + ((lane >> width) & mask);
+}
+
+hwt::hwpyramid_t::hwpyramid_t(const uint64_t code){
+	lanes[6] = code;
+	lanes[5] = code - ((code >> 1) & 0x5555555555555555ULL);
+	lanes[4] = pairwise_sums(lanes[5], 2, 0x3333333333333333ULL);
+	lanes[3] = pairwise_sums(lanes[4], 4, 0x0f0f0f0f0f0f0f0fULL);
+	lanes[2] = pairwise_sums(lanes[3], 8, 0x00ff00ff00ff00ffULL);
+	lanes[1] = pairwise_sums(lanes[2], 16, 0x0000ffff0000ffffULL);
+	lanes[0] = pairwise_sums(lanes[1], 32, 0x00000000ffffffffULL);
+}
+
+/* weights of one lane, most significant segment first */
+template<int level>
+static inline void unpack_lane(const uint64_t lane, uint8_t *wts){
+	const int width = NDIMS >> level;
+	const uint64_t mask = (width == NDIMS) ? 0xffffffffffffffffULL : (0x01ULL << (width % NDIMS)) - 1;
+	for (int i=0;i < (1 << level);i++){
+		wts[i] = (uint8_t)((lane >> (NDIMS - (i+1)*width)) & mask);
+	}
+	memset(wts + (1 << level), 0, NDIMS - (1 << level));
+}
+
+void hwt::hwpyramid_t::Level(const int level, hw_t &wts)const{
+	switch (level){
+	case 0: unpack_lane<0>(lanes[0], wts.wts); break;
+	case 1: unpack_lane<1>(lanes[1], wts.wts); break;
+	case 2: unpack_lane<2>(lanes[2], wts.wts); break;
+	case 3: unpack_lane<3>(lanes[3], wts.wts); break;
+	case 4: unpack_lane<4>(lanes[4], wts.wts); break;
+	case 5: unpack_lane<5>(lanes[5], wts.wts); break;
+	default: unpack_lane<6>(lanes[6], wts.wts); break;
+	}
+}
 
 /** calc hamming weights for hw_t  **/
 void hwt::calc_hwts(struct hw_t &hwts, const uint64_t code, const int level){
+	hwpyramid_t(code).Level(level, hwts);
+}
 
-	uint64_t mask = 0xffffffffffffffffULL;
+/** scan n contiguous codes, append positions of those within radius of target **/
+void hwt::scan_codes(const uint64_t *codes, const size_t n, const uint64_t target, const int radius,
+					 std::vector<size_t> &positions){
 
-	if (level == 0){
-		hwts.wts[0] = (uint8_t)__builtin_popcountll(code);
-		return;
+	const size_t blocksize = 64;
+	uint8_t dists[blocksize];
+
+	/* distances for a whole block first, so the inner loop stays branch free */
+	for (size_t i=0;i < n;i += blocksize){
+		size_t m = (n - i < blocksize) ? n - i : blocksize;
+		hwt_kernels->distances(codes + i, 1, m, target, dists);
+		for (size_t j=0;j < m;j++){
+			if (dists[j] <= radius) positions.push_back(i+j);
+		}
 	}
-	
-	int shiftby = 0;
-	int n = 1;
-	while (n <= level) shiftby += NDIMS/(1 << n++);
+	hc_t::n_query_ops.Add(n);
+}
 
-	mask <<= shiftby;
-	shiftby = NDIMS - shiftby;
+/** compare all codes a[i] against all codes b[j] in blocks, append (i, j) of pairs within radius **/
+void hwt::join_codes(const uint64_t *a, const size_t na, const uint64_t *b, const size_t nb, const int radius,
+					 std::vector<std::pair<size_t,size_t>> &pairs){
 
-	int index = 0;
-	while (mask){
-		hwts.wts[index++] = (uint8_t)__builtin_popcountll(mask&code);
-		mask >>= shiftby;
-	}	
+	const size_t blocksize = 64;
+	uint8_t dists[blocksize];
+
+	/* each block of b stays in cache while all of a passes over it */
+	for (size_t j=0;j < nb;j += blocksize){
+		size_t m = (nb - j < blocksize) ? nb - j : blocksize;
+		for (size_t i=0;i < na;i++){
+			hwt_kernels->distances(b + j, 1, m, a[i], dists);
+			for (size_t k=0;k < m;k++){
+				if (dists[k] <= radius) pairs.push_back({ i, j+k });
+			}
+		}
+	}
 }
 
-	
+/** join_codes of a against itself, each pair once: append (i, j), i < j, of pairs within radius **/
+void hwt::self_join_codes(const uint64_t *a, const size_t n, const int radius,
+						  std::vector<std::pair<size_t,size_t>> &pairs){
 
+	const size_t blocksize = 64;
+	uint8_t dists[blocksize];
 
+	/* only the part of each block past i is compared against a[i] */
+	for (size_t j=0;j < n;j += blocksize){
+		size_t end = (n - j < blocksize) ? n : j + blocksize;
+		for (size_t i=0;i+1 < end;i++){
+			size_t first = (i+1 > j) ? i+1 : j;
+			hwt_kernels->distances(a + first, 1, end - first, a[i], dists);
+			for (size_t k=0;k < end - first;k++){
+				if (dists[k] <= radius) pairs.push_back({ i, first+k });
+			}
+		}
+	}
+}
@@ -0,0 +1,106 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#include "hwt/hwtcursor.hpp"
+
+using namespace std;
+using namespace hwt;
+
+hwt::HWTCursor::HWTCursor(shared_ptr<const HWTree> snapshot, const uint64_t target)
+	:m_snapshot(snapshot),m_target(target){
+
+	hwpyramid_t pyramid(target);
+	for (int level=0;level < NLEVELS;level++){
+		pyramid.Level(level, m_wts[level]);
+	}
+	if (m_snapshot && m_snapshot->m_top){
+		m_frontier.push({ 0, m_snapshot->m_top, 0, hc_t(), 0, 0 });
+	}
+}
+
+void hwt::HWTCursor::ExpandTop(){
+	item_t current = m_frontier.top();
+	m_frontier.pop();
+
+	if (current.node->IsLeaf()){
+		const HWTLeaf *leaf = (const HWTLeaf*)current.node;
+		vector<pair<int, hc_t>> ranked;
+		if (current.last > 0){
+			leaf->RankRange(current.first, current.last, m_target, ranked);
+		} else {
+			/* the tail is ranked now, as a range search scans it whole */
+			leaf->RankRange(leaf->Ordered(), leaf->Size(), m_target, ranked);
+			vector<hwband_t> bands;
+			leaf->GetBands(m_target, bands);
+			for (const hwband_t &band : bands){
+				m_frontier.push({ max(band.bound, current.bound), current.node, current.level, hc_t(),
+								  band.first, band.last });
+			}
+		}
+		for (const pair<int, hc_t> &r : ranked){
+			m_frontier.push({ r.first, NULL, 0, r.second, 0, 0 });
+		}
+		return;
+	}
+
+	/* a child's bound is kept at least its parent's, so bounds come off in order */
+	const HWTInternal *internal = (const HWTInternal*)current.node;
+	const int keylevel = current.level + internal->Skip();
+	const hwchildmap_t &children = internal->GetChildMap();
+	for (auto iter = children.begin(); iter != children.end(); ++iter){
+		int bound = max(iter->second.sum.distance(m_target), m_wts[keylevel].distance(iter->first));
+		m_frontier.push({ max(bound, current.bound), iter->second.node, keylevel+1, hc_t(), 0, 0 });
+	}
+}
+
+vector<hc_t> hwt::HWTCursor::Next(const size_t n){
+	vector<hc_t> results;
+	while (results.size() < n && !m_frontier.empty()){
+		if (m_frontier.top().node != NULL){
+			ExpandTop();
+			continue;
+		}
+		results.push_back(m_frontier.top().entry);
+		m_frontier.pop();
+	}
+	return results;
+}
+
+vector<hc_t> hwt::HWTCursor::NextWithin(const int radius){
+	vector<hc_t> results;
+
+	/* nodes bounded past radius stay unexpanded for later calls */
+	while (!m_frontier.empty() && m_frontier.top().bound <= radius){
+		if (m_frontier.top().node != NULL){
+			ExpandTop();
+			continue;
+		}
+		results.push_back(m_frontier.top().entry);
+		m_frontier.pop();
+	}
+	return results;
+}
+
+int hwt::HWTCursor::Bound()const{
+	if (m_frontier.empty()) return -1;
+	return m_frontier.top().bound;
+}
+
+size_t hwt::HWTCursor::FrontierSize()const{
+	return m_frontier.size();
+}
@@ -0,0 +1,265 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#include <thread>
+#include <atomic>
+#include "hwt/hwtree.hpp"
+
+using namespace std;
+using namespace hwt;
+
+/* parameters of one join */
+struct join_t {
+	int radius;
+	function<void(const hc_t&, const hc_t&)> callback;
+};
+
+typedef const hwchildmap_t::value_type* hwchildref_t;
+
+static void get_children(const HWTNode *node, vector<hwchildref_t> &children){
+	const hwchildmap_t &childmap = ((const HWTInternal*)node)->GetChildMap();
+	for (auto iter = childmap.begin(); iter != childmap.end(); ++iter){
+		children.push_back(&*iter);
+	}
+}
+
+/* can any code beneath a be within radius of any code beneath b */
+static bool children_overlap(hwchildref_t a, hwchildref_t b, const int radius){
+	return a->second.sum.distance(b->second.sum) <= radius && a->first.distance(b->first) <= radius;
+}
+
+/* compare two lists of leaf entries; same when both are one leaf, swapped
+   reports pairs as (b entry, a entry) */
+static void join_leaf(const vector<hc_t> &ea, const vector<hc_t> &eb, const bool same,
+					  const bool swapped, const join_t &join){
+	vector<uint64_t> ca(ea.size()), cb(eb.size());
+	for (size_t i=0;i < ea.size();i++) ca[i] = ea[i].code;
+	for (size_t j=0;j < eb.size();j++) cb[j] = eb[j].code;
+
+	vector<pair<size_t,size_t>> pairs;
+	if (same){
+		self_join_codes(ca.data(), ca.size(), join.radius, pairs);
+	} else {
+		join_codes(ca.data(), ca.size(), cb.data(), cb.size(), join.radius, pairs);
+	}
+	for (const pair<size_t,size_t> &p : pairs){
+		if (swapped){
+			join.callback(eb[p.second], ea[p.first]);
+		} else {
+			join.callback(ea[p.first], eb[p.second]);
+		}
+	}
+}
+
+/* join entries against all entries in node's subtree at level; swapped
+   reports pairs as (subtree entry, entry) */
+static void join_entries(const vector<hc_t> &entries, HWTNode *node, const int level,
+						 const bool swapped, const join_t &join){
+	if (node->IsLeaf()){
+		vector<hc_t> others;
+		((HWTLeaf*)node)->GetEntries(others);
+		join_leaf(entries, others, false, swapped, join);
+		return;
+	}
+
+	const int keylevel = level + ((HWTInternal*)node)->Skip();
+	vector<hw_t> wts(entries.size());
+	for (size_t i=0;i < entries.size();i++){
+		calc_hwts(wts[i], entries[i].code, keylevel);
+	}
+
+	vector<hwchildref_t> children;
+	get_children(node, children);
+	vector<hc_t> subset;
+	for (hwchildref_t child : children){
+		subset.clear();
+		for (size_t i=0;i < entries.size();i++){
+			if (child->second.sum.distance(entries[i].code) <= join.radius
+				&& child->first.distance(wts[i]) <= join.radius){
+				subset.push_back(entries[i]);
+			}
+		}
+		if (!subset.empty()) join_entries(subset, child->second.node, keylevel+1, swapped, join);
+	}
+}
+
+/* join subtree a at level la w/ subtree b at level lb; same when a and b are
+   one node.  Each node's shared keys reach the other's key level. */
+static void join_nodes(HWTNode *a, const int la, HWTNode *b, const int lb, const bool same,
+					   const join_t &join){
+
+	if (a->IsLeaf() && b->IsLeaf()){
+		vector<hc_t> ea, eb;
+		((HWTLeaf*)a)->GetEntries(ea);
+		if (!same) ((HWTLeaf*)b)->GetEntries(eb);
+		join_leaf(ea, same ? ea : eb, same, false, join);
+		return;
+	}
+
+	if (a->IsLeaf()){
+		vector<hc_t> ea;
+		((HWTLeaf*)a)->GetEntries(ea);
+		join_entries(ea, b, lb, false, join);
+		return;
+	}
+
+	if (b->IsLeaf()){
+		vector<hc_t> eb;
+		((HWTLeaf*)b)->GetEntries(eb);
+		join_entries(eb, a, la, true, join);
+		return;
+	}
+
+	vector<hwchildref_t> ca, cb;
+	const int ka = la + ((HWTInternal*)a)->Skip();
+	const int kb = lb + ((HWTInternal*)b)->Skip();
+
+	/* one side collapsed levels the other branches on: it goes whole
+	   against each child on the other side near its shared key */
+	if (ka != kb){
+		hw_t key;
+		if (ka < kb){
+			((HWTInternal*)b)->SharedKey(ka, key);
+			get_children(a, ca);
+			for (hwchildref_t child : ca){
+				if (child->first.distance(key) <= join.radius) join_nodes(child->second.node, ka+1, b, lb, false, join);
+			}
+		} else {
+			((HWTInternal*)a)->SharedKey(kb, key);
+			get_children(b, cb);
+			for (hwchildref_t child : cb){
+				if (child->first.distance(key) <= join.radius) join_nodes(a, la, child->second.node, kb+1, false, join);
+			}
+		}
+		return;
+	}
+
+	get_children(a, ca);
+	if (!same) get_children(b, cb);
+	const vector<hwchildref_t> &others = same ? ca : cb;
+
+	for (size_t i=0;i < ca.size();i++){
+		for (size_t j=(same ? i : 0);j < others.size();j++){
+			if (children_overlap(ca[i], others[j], join.radius)){
+				join_nodes(ca[i]->second.node, ka+1, others[j]->second.node, kb+1, same && i == j, join);
+			}
+		}
+	}
+}
+
+/* run task(0..n-1) on n_threads threads, each taking the next index */
+static void parallel_for(const size_t n, int n_threads, function<void(size_t)> task){
+	if (n_threads <= 0) n_threads = (int)thread::hardware_concurrency();
+	if (n_threads <= 0) n_threads = 1;
+	if ((size_t)n_threads > n) n_threads = (int)n;
+
+	atomic<size_t> next(0);
+	auto worker = [&](){
+		for (size_t i = next++;i < n;i = next++){
+			task(i);
+		}
+	};
+
+	vector<thread> threads;
+	for (int i=1;i < n_threads;i++){
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (thread &t : threads){
+		t.join();
+	}
+}
+
+void hwt::HWTree::SelfJoin(const int radius, function<void(const hc_t&, const hc_t&)> callback,
+						   const int n_threads)const{
+	if (m_top == NULL || radius < 0) return;
+
+	join_t join = { radius, callback };
+	if (m_top->IsLeaf()){
+		join_nodes(m_top, 0, m_top, 0, true, join);
+		return;
+	}
+
+	/* unordered pairs of top-level subtrees that can hold a qualifying pair */
+	const int keylevel = ((HWTInternal*)m_top)->Skip();
+	vector<hwchildref_t> children;
+	get_children(m_top, children);
+	vector<pair<size_t,size_t>> pairs;
+	for (size_t i=0;i < children.size();i++){
+		for (size_t j=i;j < children.size();j++){
+			if (children_overlap(children[i], children[j], radius)) pairs.push_back({ i, j });
+		}
+	}
+
+	parallel_for(pairs.size(), n_threads, [&](size_t k){
+		size_t i = pairs[k].first, j = pairs[k].second;
+		join_nodes(children[i]->second.node, keylevel+1, children[j]->second.node, keylevel+1, i == j, join);
+	});
+}
+
+void hwt::HWTree::Join(const HWTree &other, const int radius,
+					   function<void(const hc_t&, const hc_t&)> callback, const int n_threads)const{
+	if (m_top == NULL || other.m_top == NULL || radius < 0) return;
+
+	join_t join = { radius, callback };
+	if (m_top->IsLeaf() || other.m_top->IsLeaf()){
+		join_nodes(m_top, 0, other.m_top, 0, false, join);
+		return;
+	}
+
+	/* pairs of subtrees, w/ their levels, that can hold a qualifying pair */
+	struct task_t {
+		HWTNode *a;
+		int la;
+		HWTNode *b;
+		int lb;
+	};
+
+	const int ka = ((HWTInternal*)m_top)->Skip();
+	const int kb = ((HWTInternal*)other.m_top)->Skip();
+	vector<hwchildref_t> children, others;
+	vector<task_t> tasks;
+	hw_t key;
+	if (ka < kb){
+		((HWTInternal*)other.m_top)->SharedKey(ka, key);
+		get_children(m_top, children);
+		for (hwchildref_t child : children){
+			if (child->first.distance(key) <= radius) tasks.push_back({ child->second.node, ka+1, other.m_top, 0 });
+		}
+	} else if (kb < ka){
+		((HWTInternal*)m_top)->SharedKey(kb, key);
+		get_children(other.m_top, others);
+		for (hwchildref_t child : others){
+			if (child->first.distance(key) <= radius) tasks.push_back({ m_top, 0, child->second.node, kb+1 });
+		}
+	} else {
+		get_children(m_top, children);
+		get_children(other.m_top, others);
+		for (size_t i=0;i < children.size();i++){
+			for (size_t j=0;j < others.size();j++){
+				if (children_overlap(children[i], others[j], radius)){
+					tasks.push_back({ children[i]->second.node, ka+1, others[j]->second.node, kb+1 });
+				}
+			}
+		}
+	}
+
+	parallel_for(tasks.size(), n_threads, [&](size_t k){
+		join_nodes(tasks[k].a, tasks[k].la, tasks[k].b, tasks[k].lb, false, join);
+	});
+}
@@ -0,0 +1,304 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#include <cstring>
+#include "hwt/hwt.hpp"
+#include "hwt/hwtkernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HWT_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace hwt;
+
+/**
+ *
+ *  scalar
+ *
+ **/
+
+static inline int popcount_swar(uint64_t x){
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)((x*0x0101010101010101ULL) >> 56);
+}
+
+static void distances_scalar(const uint64_t *codes, const size_t stride, const size_t n,
+							 const uint64_t target, uint8_t *dists){
+	for (size_t i=0;i < n;i++){
+		dists[i] = (uint8_t)popcount_swar(codes[i*stride]^target);
+	}
+}
+
+static int distance_scalar(const uint64_t a, const uint64_t b){
+	return popcount_swar(a^b);
+}
+
+static int l1distance_scalar(const uint8_t *a, const uint8_t *b){
+	int sum = 0;
+	for (int i=0;i < NDIMS;i++){
+		sum += abs((int)a[i] - (int)b[i]);
+	}
+	return sum;
+}
+
+#ifdef HWT_X86
+
+/**
+ *
+ *  popcnt
+ *
+ **/
+
+__attribute__((target("popcnt")))
+static void distances_popcnt(const uint64_t *codes, const size_t stride, const size_t n,
+							 const uint64_t target, uint8_t *dists){
+	for (size_t i=0;i < n;i++){
+		dists[i] = (uint8_t)__builtin_popcountll(codes[i*stride]^target);
+	}
+}
+
+__attribute__((target("popcnt")))
+static int distance_popcnt(const uint64_t a, const uint64_t b){
+	return __builtin_popcountll(a^b);
+}
+
+__attribute__((target("sse2")))
+static int l1distance_sse2(const uint8_t *a, const uint8_t *b){
+	__m128i sum = _mm_setzero_si128();
+	for (int i=0;i < NDIMS;i += 16){
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+	}
+	return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+}
+
+/**
+ *
+ *  avx2
+ *
+ **/
+
+/* per 64-bit lane popcount: nibble table lookup, then sum the bytes */
+__attribute__((target("avx2")))
+static inline __m256i popcount256(const __m256i v){
+	const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+										 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+	__m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+	return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2,popcnt")))
+static void distances_avx2(const uint64_t *codes, const size_t stride, const size_t n,
+						   const uint64_t target, uint8_t *dists){
+	const __m256i t = _mm256_set1_epi64x((long long)target);
+	uint64_t counts[4];
+	size_t i = 0;
+	if (stride == 1){
+		for (;i + 4 <= n;i += 4){
+			__m256i v = _mm256_loadu_si256((const __m256i*)(codes + i));
+			_mm256_storeu_si256((__m256i*)counts, popcount256(_mm256_xor_si256(v, t)));
+			for (int k=0;k < 4;k++) dists[i+k] = (uint8_t)counts[k];
+		}
+	} else if (stride == 2){
+		/* codes at even positions; stop early enough not to load past the last */
+		for (;i + 5 <= n;i += 4){
+			__m256i v0 = _mm256_loadu_si256((const __m256i*)(codes + 2*i));
+			__m256i v1 = _mm256_loadu_si256((const __m256i*)(codes + 2*i + 4));
+			__m256i v = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(v0, v1), 0xd8);
+			_mm256_storeu_si256((__m256i*)counts, popcount256(_mm256_xor_si256(v, t)));
+			for (int k=0;k < 4;k++) dists[i+k] = (uint8_t)counts[k];
+		}
+	}
+	for (;i < n;i++){
+		dists[i] = (uint8_t)__builtin_popcountll(codes[i*stride]^target);
+	}
+}
+
+__attribute__((target("avx2")))
+static int l1distance_avx2(const uint8_t *a, const uint8_t *b){
+	__m256i s0 = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)a), _mm256_loadu_si256((const __m256i*)b));
+	__m256i s1 = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(a + 32)),
+								 _mm256_loadu_si256((const __m256i*)(b + 32)));
+	__m256i s = _mm256_add_epi64(s0, s1);
+	__m128i h = _mm_add_epi64(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+	return _mm_cvtsi128_si32(h) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(h, h));
+}
+
+/**
+ *
+ *  avx512
+ *
+ **/
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i popcount512(const __m512i v){
+	const __m512i lut = _mm512_set4_epi32(0x04030302, 0x03020201, 0x03020201, 0x02010100);
+	const __m512i low = _mm512_set1_epi8(0x0f);
+	__m512i lo = _mm512_shuffle_epi8(lut, _mm512_and_si512(v, low));
+	__m512i hi = _mm512_shuffle_epi8(lut, _mm512_and_si512(_mm512_srli_epi16(v, 4), low));
+	return _mm512_sad_epu8(_mm512_add_epi8(lo, hi), _mm512_setzero_si512());
+}
+
+/* eight codes at stride 1, else at stride 2, into one register */
+__attribute__((target("avx512f")))
+static inline __m512i load8(const uint64_t *codes, const size_t stride, const size_t i){
+	if (stride == 1) return _mm512_loadu_si512((const void*)(codes + i));
+	const __m512i evens = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+	__m512i v0 = _mm512_loadu_si512((const void*)(codes + 2*i));
+	__m512i v1 = _mm512_loadu_si512((const void*)(codes + 2*i + 8));
+	return _mm512_permutex2var_epi64(v0, evens, v1);
+}
+
+/* no. codes the 8-wide loop may cover w/o loading past the last code */
+static inline size_t vector_limit(const size_t stride, const size_t n){
+	if (stride == 1) return n;
+	if (stride == 2) return (n > 0) ? n - 1 : 0;
+	return 0;
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static void distances_avx512(const uint64_t *codes, const size_t stride, const size_t n,
+							 const uint64_t target, uint8_t *dists){
+	const __m512i t = _mm512_set1_epi64((long long)target);
+	const size_t limit = vector_limit(stride, n);
+	size_t i = 0;
+	for (;i + 8 <= limit;i += 8){
+		__m512i counts = popcount512(_mm512_xor_si512(load8(codes, stride, i), t));
+		_mm_storel_epi64((__m128i*)(dists + i), _mm512_maskz_cvtepi64_epi8(0xff, counts));
+	}
+	for (;i < n;i++){
+		dists[i] = (uint8_t)__builtin_popcountll(codes[i*stride]^target);
+	}
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static void distances_vpopcnt(const uint64_t *codes, const size_t stride, const size_t n,
+							  const uint64_t target, uint8_t *dists){
+	const __m512i t = _mm512_set1_epi64((long long)target);
+	const size_t limit = vector_limit(stride, n);
+	size_t i = 0;
+	for (;i + 8 <= limit;i += 8){
+		__m512i counts = _mm512_popcnt_epi64(_mm512_xor_si512(load8(codes, stride, i), t));
+		_mm_storel_epi64((__m128i*)(dists + i), _mm512_maskz_cvtepi64_epi8(0xff, counts));
+	}
+	for (;i < n;i++){
+		dists[i] = (uint8_t)__builtin_popcountll(codes[i*stride]^target);
+	}
+}
+
+__attribute__((target("avx512f,avx512bw,avx2")))
+static int l1distance_avx512(const uint8_t *a, const uint8_t *b){
+	__m512i s = _mm512_sad_epu8(_mm512_loadu_si512((const void*)a), _mm512_loadu_si512((const void*)b));
+	__m256i q = _mm256_add_epi64(_mm512_maskz_extracti64x4_epi64(0xff, s, 0),
+								  _mm512_maskz_extracti64x4_epi64(0xff, s, 1));
+	__m128i h = _mm_add_epi64(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+	return _mm_cvtsi128_si32(h) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(h, h));
+}
+
+#endif /* HWT_X86 */
+
+/**
+ *
+ *  dispatch
+ *
+ **/
+
+static const hwtkernels_t kernels_scalar = { ISA_SCALAR, "scalar", distances_scalar, l1distance_scalar,
+											distance_scalar };
+
+#ifdef HWT_X86
+/* one pair of codes is a single popcnt in every x86 variant */
+static const hwtkernels_t kernels_popcnt = { ISA_POPCNT, "popcnt", distances_popcnt, l1distance_sse2,
+											distance_popcnt };
+static const hwtkernels_t kernels_avx2 = { ISA_AVX2, "avx2", distances_avx2, l1distance_avx2, distance_popcnt };
+static const hwtkernels_t kernels_avx512 = { ISA_AVX512, "avx512", distances_avx512, l1distance_avx512,
+											distance_popcnt };
+static const hwtkernels_t kernels_vpopcnt = { ISA_VPOPCNT, "vpopcnt", distances_vpopcnt, l1distance_avx512,
+											 distance_popcnt };
+#endif
+
+/* constant initialized, so usable before the selection below runs */
+const hwtkernels_t *hwt::hwt_kernels = &kernels_scalar;
+
+static const hwtkernels_t* get_kernels(const hwtisa_t isa){
+	switch (isa){
+	case ISA_SCALAR: return &kernels_scalar;
+#ifdef HWT_X86
+	case ISA_POPCNT: return &kernels_popcnt;
+	case ISA_AVX2: return &kernels_avx2;
+	case ISA_AVX512: return &kernels_avx512;
+	case ISA_VPOPCNT: return &kernels_vpopcnt;
+#endif
+	default: return NULL;
+	}
+}
+
+bool hwt::isa_supported(const hwtisa_t isa){
+	if (get_kernels(isa) == NULL) return false;
+#ifdef HWT_X86
+	__builtin_cpu_init();
+	switch (isa){
+	case ISA_POPCNT: return __builtin_cpu_supports("popcnt");
+	case ISA_AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+	case ISA_AVX512: return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt");
+	/* shares the avx512bw l1distance kernel */
+	case ISA_VPOPCNT: return __builtin_cpu_supports("avx512vpopcntdq") && __builtin_cpu_supports("avx512bw")
+			&& __builtin_cpu_supports("popcnt");
+	default: break;
+	}
+#endif
+	return isa == ISA_SCALAR;
+}
+
+bool hwt::select_isa(const hwtisa_t isa){
+	if (isa == ISA_AUTO){
+		for (int i=ISA_VPOPCNT;i >= ISA_SCALAR;i--){
+			if (isa_supported((hwtisa_t)i)) return select_isa((hwtisa_t)i);
+		}
+		return false;
+	}
+
+	if (!isa_supported(isa)) return false;
+	hwt_kernels = get_kernels(isa);
+	return true;
+}
+
+const char* hwt::isa_name(const hwtisa_t isa){
+	const hwtkernels_t *kernels = get_kernels(isa);
+	return kernels ? kernels->name : "auto";
+}
+
+/* pick the kernels once at startup */
+static bool select_startup_isa(){
+	const char *name = getenv("HWT_ISA");
+	if (name){
+		for (int i=ISA_SCALAR;i < ISA_AUTO;i++){
+			if (strcmp(name, isa_name((hwtisa_t)i)) == 0 && select_isa((hwtisa_t)i)) return true;
+		}
+	}
+	return select_isa(ISA_AUTO);
+}
+
+static const bool startup_isa_selected = select_startup_isa();
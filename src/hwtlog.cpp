@@ -0,0 +1,302 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "hwt/hwtlog.hpp"
+
+using namespace std;
+using namespace hwt;
+
+#define SNAPSHOT_MAGIC "HWTSNAP2"
+#define LOG_MAGIC "HWTLOG02"
+#define IO_CHUNK 4096
+
+static void throw_errno(const string &what, const string &path){
+	throw runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+/* fnv-1a over all fields but the checksum itself */
+static uint32_t record_check(const hwtrecord_t &rec){
+	const uint8_t *bytes = (const uint8_t*)&rec;
+	uint32_t hash = 2166136261U;
+	for (size_t i=0;i < offsetof(hwtrecord_t, check);i++){
+		hash = (hash ^ bytes[i])*16777619U;
+	}
+	return hash;
+}
+
+static void write_all(const int fd, const void *buf, size_t nbytes, const string &path){
+	const char *p = (const char*)buf;
+	while (nbytes > 0){
+		ssize_t n = write(fd, p, nbytes);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			throw_errno("write", path);
+		}
+		p += n;
+		nbytes -= n;
+	}
+}
+
+static size_t read_all(const int fd, void *buf, size_t nbytes, off_t offset, const string &path){
+	char *p = (char*)buf;
+	size_t total = 0;
+	while (total < nbytes){
+		ssize_t n = pread(fd, p + total, nbytes - total, offset + total);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			throw_errno("read", path);
+		}
+		if (n == 0) break;
+		total += n;
+	}
+	return total;
+}
+
+/* visit valid records in chunks, returns byte length of the valid prefix */
+static off_t scan_log(const int fd, const string &path,
+					  function<void(const hwtrecord_t *recs, const size_t n)> visit){
+	vector<hwtrecord_t> chunk(IO_CHUNK);
+	off_t offset = sizeof(uint64_t);
+	uint64_t last = 0;
+	while (true){
+		size_t nbytes = read_all(fd, chunk.data(), IO_CHUNK*sizeof(hwtrecord_t), offset, path);
+		size_t n = nbytes/sizeof(hwtrecord_t);
+
+		/* stop at first torn or corrupt record */
+		size_t nvalid = 0;
+		while (nvalid < n && chunk[nvalid].check == record_check(chunk[nvalid]) && chunk[nvalid].lsn > last){
+			last = chunk[nvalid++].lsn;
+		}
+		if (nvalid > 0) visit(chunk.data(), nvalid);
+		offset += nvalid*sizeof(hwtrecord_t);
+		if (nvalid < IO_CHUNK) break;
+	}
+	return offset;
+}
+
+hwt::HWTLog::HWTLog(const string &path, const hwtsync_t policy, const size_t groupsize, const int interval_ms){
+	m_path = path;
+	m_policy = policy;
+	m_groupsize = (groupsize > 0) ? groupsize : 1;
+	m_interval = chrono::milliseconds(interval_ms);
+	m_lastsync = chrono::steady_clock::now();
+	m_lsn = 0;
+
+	m_fd = open(path.c_str(), O_RDWR|O_CREAT|O_APPEND, 0644);
+	if (m_fd < 0) throw_errno("open", path);
+
+	/* a new log gets the header, an existing one must have it */
+	char magic[sizeof(uint64_t)];
+	size_t nmagic = read_all(m_fd, magic, sizeof(magic), 0, path);
+	if (nmagic == 0){
+		write_all(m_fd, LOG_MAGIC, sizeof(magic), path);
+	} else if (nmagic != sizeof(magic) || memcmp(magic, LOG_MAGIC, sizeof(magic))){
+		close(m_fd);
+		throw runtime_error("bad log " + path);
+	}
+
+	/* continue numbering after the last valid record, drop any torn tail */
+	off_t valid = scan_log(m_fd, m_path, [this](const hwtrecord_t *recs, const size_t n){
+		m_lsn = recs[n-1].lsn;
+	});
+	off_t length = lseek(m_fd, 0, SEEK_END);
+	if (length > valid && ftruncate(m_fd, valid) < 0){
+		close(m_fd);
+		throw_errno("truncate", path);
+	}
+	m_pending.reserve(m_groupsize);
+}
+
+hwt::HWTLog::~HWTLog(){
+	try {
+		Commit();
+	} catch (...){
+	}
+	close(m_fd);
+}
+
+void hwt::HWTLog::Write(const void *buf, const size_t nbytes){
+	write_all(m_fd, buf, nbytes, m_path);
+}
+
+uint64_t hwt::HWTLog::Append(const uint32_t op, const hc_t &e, const uint32_t tenant){
+	hwtrecord_t rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.lsn = ++m_lsn;
+	rec.id = e.id;
+	rec.code = e.code;
+	rec.op = op;
+	rec.tenant = tenant;
+	rec.check = record_check(rec);
+	m_pending.push_back(rec);
+
+	if (m_pending.size() >= m_groupsize) Commit();
+	return rec.lsn;
+}
+
+void hwt::HWTLog::Commit(){
+	if (!m_pending.empty()){
+		Write(m_pending.data(), m_pending.size()*sizeof(hwtrecord_t));
+		m_pending.clear();
+	}
+
+	if (m_policy == SYNC_COMMIT){
+		Sync();
+	} else if (m_policy == SYNC_INTERVAL && chrono::steady_clock::now() - m_lastsync >= m_interval){
+		Sync();
+	}
+}
+
+void hwt::HWTLog::Sync(){
+	if (!m_pending.empty()){
+		Write(m_pending.data(), m_pending.size()*sizeof(hwtrecord_t));
+		m_pending.clear();
+	}
+	if (fdatasync(m_fd) < 0) throw_errno("sync", m_path);
+	m_lastsync = chrono::steady_clock::now();
+}
+
+void hwt::HWTLog::Truncate(){
+	if (ftruncate(m_fd, sizeof(uint64_t)) < 0) throw_errno("truncate", m_path);
+	if (fdatasync(m_fd) < 0) throw_errno("sync", m_path);
+	m_lastsync = chrono::steady_clock::now();
+}
+
+size_t hwt::HWTLog::Replay(const uint64_t after, function<void(const vector<hwtrecord_t>&)> apply,
+						   const size_t batchsize){
+	Commit();
+
+	vector<hwtrecord_t> batch;
+	batch.reserve(batchsize);
+	size_t n_applied = 0;
+	scan_log(m_fd, m_path, [&](const hwtrecord_t *recs, const size_t n){
+		for (size_t i=0;i < n;i++){
+			if (recs[i].lsn <= after) continue;
+			batch.push_back(recs[i]);
+			if (batch.size() >= batchsize){
+				apply(batch);
+				n_applied += batch.size();
+				batch.clear();
+			}
+		}
+	});
+	if (!batch.empty()){
+		apply(batch);
+		n_applied += batch.size();
+	}
+
+	/* records appended from here on must sort after the snapshot */
+	if (m_lsn < after) m_lsn = after;
+	return n_applied;
+}
+
+uint64_t hwt::HWTLog::LastLSN()const{
+	return m_lsn;
+}
+
+void hwt::write_snapshot(const string &path, const uint64_t lsn, const vector<hc_t> &entries,
+						 const vector<uint32_t> &tenants){
+	const string tmppath = path + ".tmp";
+	int fd = open(tmppath.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) throw_errno("open", tmppath);
+
+	try {
+		uint64_t header[3];
+		memcpy(&header[0], SNAPSHOT_MAGIC, sizeof(uint64_t));
+		header[1] = lsn;
+		header[2] = entries.size();
+		write_all(fd, header, sizeof(header), tmppath);
+
+		vector<uint64_t> chunk;
+		chunk.reserve(3*IO_CHUNK);
+		for (size_t i=0;i < entries.size();i++){
+			chunk.push_back((uint64_t)entries[i].id);
+			chunk.push_back(entries[i].code);
+			chunk.push_back(tenants.empty() ? 0 : tenants[i]);
+			if (chunk.size() == 3*IO_CHUNK || i == entries.size()-1){
+				write_all(fd, chunk.data(), chunk.size()*sizeof(uint64_t), tmppath);
+				chunk.clear();
+			}
+		}
+		if (fsync(fd) < 0) throw_errno("sync", tmppath);
+	} catch (...){
+		close(fd);
+		unlink(tmppath.c_str());
+		throw;
+	}
+	close(fd);
+
+	if (rename(tmppath.c_str(), path.c_str()) < 0) throw_errno("rename", tmppath);
+
+	/* make the rename itself durable */
+	size_t slash = path.find_last_of('/');
+	string dir = (slash == string::npos) ? "." : path.substr(0, slash+1);
+	int dirfd = open(dir.c_str(), O_RDONLY);
+	if (dirfd >= 0){
+		fsync(dirfd);
+		close(dirfd);
+	}
+}
+
+uint64_t hwt::read_snapshot(const string &path, vector<hc_t> &entries, vector<uint32_t> &tenants){
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0){
+		if (errno == ENOENT) return 0;
+		throw_errno("open", path);
+	}
+
+	uint64_t header[3];
+	uint64_t lsn = 0;
+	try {
+		if (read_all(fd, header, sizeof(header), 0, path) != sizeof(header)
+			|| memcmp(&header[0], SNAPSHOT_MAGIC, sizeof(uint64_t))){
+			throw runtime_error("bad snapshot " + path);
+		}
+		lsn = header[1];
+
+		size_t count = header[2];
+		entries.reserve(entries.size() + count);
+		tenants.reserve(tenants.size() + count);
+		vector<uint64_t> chunk(3*IO_CHUNK);
+		off_t offset = sizeof(header);
+		while (count > 0){
+			size_t n = (count < IO_CHUNK) ? count : IO_CHUNK;
+			size_t nbytes = 3*n*sizeof(uint64_t);
+			if (read_all(fd, chunk.data(), nbytes, offset, path) != nbytes){
+				throw runtime_error("truncated snapshot " + path);
+			}
+			for (size_t i=0;i < n;i++){
+				entries.push_back({ (long long)chunk[3*i], chunk[3*i+1] });
+				tenants.push_back((uint32_t)chunk[3*i+2]);
+			}
+			offset += nbytes;
+			count -= n;
+		}
+	} catch (...){
+		close(fd);
+		throw;
+	}
+	close(fd);
+	return lsn;
+}
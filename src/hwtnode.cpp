@@ -18,19 +18,124 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 #include "hwt/hwtnode.hpp"
 
 using namespace std;
 
+hwt::hwopcount_t hwt::HWTNode::n_summary_ops;
+
+/**
+ *
+ *  HWTNode methods
+ *
+ **/
+
+void hwt::HWTNode::Ref(){
+	m_refs.fetch_add(1, memory_order_relaxed);
+}
+
+bool hwt::HWTNode::Shared()const{
+	return m_refs.load(memory_order_acquire) > 1;
+}
+
+void hwt::HWTNode::Release(HWTNode *node){
+	vector<HWTNode*> nodes;
+	if (node) nodes.push_back(node);
+
+	while (!nodes.empty()){
+		HWTNode *current = nodes.back();
+		nodes.pop_back();
+		if (current->m_refs.fetch_sub(1, memory_order_acq_rel) > 1) continue;
+
+		if (!current->IsLeaf()){
+			const hwchildmap_t &children = ((HWTInternal*)current)->GetChildMap();
+			for (auto iter = children.begin(); iter != children.end(); ++iter){
+				nodes.push_back(iter->second.node);
+			}
+		}
+		delete current;
+	}
+}
+
+hwt::HWTNode* hwt::HWTNode::Unshare(HWTNode *node){
+	if (node == NULL || !node->Shared()) return node;
+
+	HWTNode *copy = node->Clone();
+	Release(node);
+	return copy;
+}
+
+hwt::HWTNode* hwt::HWTNode::AddEntries(const vector<hc_t> &entries, const vector<uint32_t> &tenants,
+									   const int level){
+	hwbatch_t batch(entries.data(), tenants.empty() ? NULL : tenants.data(), entries.size());
+	return AddBatch(batch, 0, entries.size(), level);
+}
+
+/* lanes 0 to 4 of a pyramid packed into one key of the same order: given a
+   level's lane, the next is fixed by its even segments, the odd ones being
+   the differences */
+static uint64_t batch_key(const hwt::hwpyramid_t &pyramid){
+	uint64_t key = pyramid.lanes[0];
+	for (int l=1;l < NLEVELS-2;l++){
+		const int width = NDIMS >> l;
+		for (int i=0;i < (1 << l);i += 2){
+			key = (key << (NLEVELS - l)) | ((pyramid.lanes[l] >> (NDIMS - (i+1)*width)) & ((0x01ULL << width) - 1));
+		}
+	}
+	return key;
+}
+
+/* a batch entry's place in batch order */
+struct batch_order_t {
+	uint64_t key;
+	uint64_t code;
+	size_t pos;
+	bool operator<(const batch_order_t &other)const{
+		if (key != other.key) return key < other.key;
+		const uint64_t a = hwt::hwpyramid_t(code).lanes[NLEVELS-2];
+		const uint64_t b = hwt::hwpyramid_t(other.code).lanes[NLEVELS-2];
+		return (a != b) ? a < b : code < other.code;
+	}
+};
+
+hwt::hwbatch_t::hwbatch_t(const hc_t *entries, const uint32_t *tenants, const size_t n)
+	:entries(entries),tenants(tenants){
+	/* order the codes before laying out the items, a cache line each */
+	vector<batch_order_t> order(n);
+	for (size_t i=0;i < n;i++){
+		order[i] = { batch_key(hwpyramid_t(entries[i].code)), entries[i].code, i };
+	}
+	sort(order.begin(), order.end());
+	items.reserve(n);
+	for (const batch_order_t &o : order){
+		items.emplace_back(o.code, o.pos);
+	}
+}
+
+bool hwt::hwbatch_t::Before(const hwbatchitem_t &a, const hwbatchitem_t &b){
+	const batch_order_t x = { batch_key(a.pyramid), a.pyramid.lanes[NLEVELS-1], a.pos };
+	const batch_order_t y = { batch_key(b.pyramid), b.pyramid.lanes[NLEVELS-1], b.pos };
+	return x < y;
+}
+
 /**
  *
  *  HWTInternal methods
  *
  **/
 
+hwt::HWTNode* hwt::HWTInternal::Clone()const{
+	HWTInternal *copy = new HWTInternal(*this);
+	for (auto iter = m_childnodes.begin(); iter != m_childnodes.end(); ++iter){
+		iter->second.node->Ref();
+	}
+	return copy;
+}
+
 void hwt::HWTInternal::SetChildNode(const hw_t &key, HWTNode *node){
 
-	m_childnodes[key] = node;
+	m_childnodes[key].node = node;
 	
 }
 
@@ -38,67 +143,276 @@ void hwt::HWTInternal::UnsetChildNode(const hw_t &key){
 	m_childnodes.erase(key);
 }
 
-hwt::HWTNode* hwt::HWTInternal::AddEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level){
+void hwt::HWTInternal::Compress(const hwbatch_t &batch, const size_t first, const size_t last, const int level){
+	m_skip = 0;
+	if (last - first <= LC) return;
+
+	/* stop short of the bottom level, where leaves no longer split */
+	const hwpyramid_t &front = batch.items[first].pyramid;
+	while (level + m_skip < NLEVELS - 2){
+		const int at = level + m_skip;
+		for (size_t i=first+1;i < last;i++){
+			if (batch.items[i].pyramid.lanes[at] != front.lanes[at]) return;
+		}
+		m_code = front.lanes[NLEVELS-1];
+		m_skip++;
+	}
+}
+
+void hwt::HWTInternal::Expand(const int skip, const int level){
+	HWTInternal *below = new HWTInternal();
+	below->m_childnodes.swap(m_childnodes);
+	below->m_skip = m_skip - skip - 1;
+	below->m_code = m_code;
+
+	hw_t key;
+	calc_hwts(key, m_code, level + skip);
+	hwchild_t &child = m_childnodes[key];
+	child.node = below;
+	below->Refresh(child.sum);
+	m_skip = skip;
+}
+
+int hwt::HWTInternal::Mismatch(const hwpyramid_t &pyramid, const int level)const{
+	if (m_skip == 0 || m_childnodes.empty()) return level + m_skip;
+	return Mismatch(pyramid, hwpyramid_t(m_code), level);
+}
+
+int hwt::HWTInternal::Mismatch(const hwpyramid_t &pyramid, const hwpyramid_t &shared, const int level)const{
+	/* equal keys at a level are equal at all coarser ones */
+	if (pyramid.lanes[level + m_skip - 1] == shared.lanes[level + m_skip - 1]) return level + m_skip;
+
+	int at = level;
+	while (pyramid.lanes[at] == shared.lanes[at]) at++;
+	return at;
+}
+
+hwt::HWTNode* hwt::HWTInternal::AddEntry(const hc_t &entry, const uint32_t tenant, const hwpyramid_t &pyramid,
+										HWTNode **next, int level){
+	if (m_childnodes.empty()){
+		m_skip = 0;
+	} else {
+		/* a second key at a collapsed level, that level gets its own node again */
+		const int at = Mismatch(pyramid, level);
+		if (at < level + m_skip) Expand(at - level, level);
+	}
+
+	hw_t wts;
+	pyramid.Level(level + m_skip, wts);
+	hwchild_t &child = m_childnodes[wts];
+	if (child.node == NULL){
+		child.node = new HWTLeaf();
+	}
 
-	if (m_childnodes.count(wts) <= 0){
-		m_childnodes[wts] = new HWTLeaf();
+	/* refresh summary left stale by earlier deletes */
+	child.node = Unshare(child.node);
+	if (child.stale){
+		child.sum = hwsum_t();
+		child.node->Refresh(child.sum);
+		child.stale = false;
 	}
-	*next = m_childnodes[wts];
+	child.sum.Add(entry.code, tenant);
+	
+	*next = child.node;
 	return this;
 }
 
-hwt::HWTNode* hwt::HWTInternal::DelEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level){
+hwt::HWTNode* hwt::HWTInternal::DelEntry(const hc_t &entry, const hwpyramid_t &pyramid, HWTNode **next, int level){
 	*next = NULL;
-	
-	if (m_childnodes.count(wts) >= 0){
-		*next = m_childnodes[wts];
+	if (Mismatch(pyramid, level) < level + m_skip) return this;
+
+	hw_t wts;
+	pyramid.Level(level + m_skip, wts);
+	auto iter = m_childnodes.find(wts);
+	if (iter != m_childnodes.end()){
+		/* summary stays a valid bound, only looser; recompute lazily */
+		iter->second.stale = true;
+		iter->second.node = Unshare(iter->second.node);
+		*next = iter->second.node;
 	}
 
 	return this;
 }
 
-void hwt::HWTInternal::AddEntries(vector<hc_t> &entries, const int level){
+hwt::HWTNode* hwt::HWTInternal::AddBatch(hwbatch_t &batch, const size_t first, const size_t last,
+										const int level){
+	if (first == last) return this;
+
+	if (m_childnodes.empty()){
+		Compress(batch, first, last, level);
+	} else if (m_skip > 0){
+		const hwpyramid_t shared(m_code);
+		int at = level + m_skip;
+		for (size_t i=first;i < last && at > level;i++){
+			at = min(at, Mismatch(batch.items[i].pyramid, shared, level));
+		}
+		if (at < level + m_skip) Expand(at - level, level);
+	}
+	const int keylevel = level + m_skip;
+
+	/* items come grouped by key, so each child grows, and splits, only once;
+	   a packed pyramid lane identifies the key w/o unpacking it */
+	hw_t wts;
+	for (size_t i=first;i < last;){
+		const uint64_t key = batch.items[i].pyramid.lanes[keylevel];
+		size_t j = i;
+		while (j < last && batch.items[j].pyramid.lanes[keylevel] == key) j++;
+
+		batch.items[i].pyramid.Level(keylevel, wts);
+		hwchild_t &child = m_childnodes[wts];
+		if (child.node == NULL) child.node = new HWTLeaf();
+		for (size_t k=i;k < j;k++){
+			child.sum.Add(batch.items[k].pyramid.lanes[NLEVELS-1], batch.Tenant(batch.items[k].pos));
+		}
+		child.node = Unshare(child.node);
+		HWTNode *node = child.node->AddBatch(batch, i, j, keylevel+1);
+		if (node != child.node){
+			Release(child.node);
+			child.node = node;
+		}
+		i = j;
+	}
+	return this;
+}
 
-	for (const hc_t &e : entries){
-		hw_t wts;
-		calc_hwts(wts, e.code, level);
+hwt::HWTNode* hwt::HWTInternal::Merge(HWTNode *other, const int level){
 
-		HWTLeaf *leaf = NULL;
-		if (m_childnodes.count(wts) > 0){
-			leaf = (HWTLeaf*)m_childnodes[wts];
-		}
+	if (other->IsLeaf()){
+		vector<hc_t> entries;
+		vector<uint32_t> tenants;
+		((HWTLeaf*)other)->GetEntries(entries, tenants);
+		AddEntries(entries, tenants, level);
+		Release(other);
+		return this;
+	}
 
-		if (leaf == NULL) leaf = new HWTLeaf();
+	if (((HWTInternal*)other)->m_childnodes.empty()){
+		Release(other);
+		return this;
+	}
+	if (m_childnodes.empty()) return other;
+
+	/* line up the collapsed levels: both keep only those they share */
+	if (m_skip > 0 || ((HWTInternal*)other)->m_skip > 0){
+		HWTInternal *o = (HWTInternal*)other;
+		hwpyramid_t mine(m_code), theirs(o->m_code);
+		int at = level;
+		while (at < level + min(m_skip, o->m_skip) && mine.lanes[at] == theirs.lanes[at]) at++;
+		if (at < level + m_skip) Expand(at - level, level);
+		if (at < level + o->m_skip){
+			other = o = (HWTInternal*)Unshare(other);
+			o->Expand(at - level, level);
+		}
+	}
+	const int keylevel = level + m_skip;
+
+	/* other may be shared w/ a snapshot, so take references to its
+	   children rather than moving them out of it */
+	const hwchildmap_t &others = ((HWTInternal*)other)->m_childnodes;
+	for (auto iter = others.begin(); iter != others.end(); ++iter){
+		iter->second.node->Ref();
+
+		auto found = m_childnodes.find(iter->first);
+		if (found == m_childnodes.end()){
+			/* no such key here, graft the whole subtree */
+			m_childnodes[iter->first] = iter->second;
+			continue;
+		}
 
-		leaf->AddEntry(e, wts, NULL, level+1);
-	
-		m_childnodes[wts] = leaf;
+		hwchild_t &child = found->second;
+		child.node = Unshare(child.node);
+		HWTNode *node = child.node->Merge(iter->second.node, keylevel+1);
+		if (node != child.node){
+			Release(child.node);
+			child.node = node;
+		}
+		child.sum.Add(iter->second.sum);
+		child.stale = child.stale || iter->second.stale;
 	}
+	Release(other);
+	return this;
 }
 
 void hwt::HWTInternal::GetChildNodes(queue<HWTNode*> &nodes){
 	for (auto iter = m_childnodes.begin(); iter != m_childnodes.end(); iter++){
-		nodes.push(iter->second);
+		nodes.push(iter->second.node);
+	}
+}
+
+const hwt::hwchildmap_t& hwt::HWTInternal::GetChildMap()const{
+	return m_childnodes;
+}
+
+int hwt::HWTInternal::Skip()const{
+	return m_skip;
+}
+
+void hwt::HWTInternal::SharedKey(const int level, hw_t &wts)const{
+	calc_hwts(wts, m_code, level);
+}
+
+bool hwt::HWTInternal::PrefixWithin(const hw_t *wts, const int radius, const int level)const{
+	if (m_skip == 0) return true;
+
+	/* the deepest shared key bounds the distance at every collapsed level */
+	hw_t key;
+	SharedKey(level + m_skip - 1, key);
+	return key.distance(wts[level + m_skip - 1]) <= radius;
+}
+
+void hwt::HWTInternal::SelectChildNodes(const hw_t &wts, const uint64_t target, const int radius,
+										 const uint64_t tenants, vector<HWTNode*> &next_nodes){
+	for (auto iter = m_childnodes.begin(); iter != m_childnodes.end(); ++iter){
+		if ((iter->second.sum.tenants & tenants) && iter->second.sum.distance(target) <= radius
+			&& wts.distance(iter->first) <= radius){
+			next_nodes.push_back(iter->second.node);
+		}
+	}
+}
+
+void hwt::HWTInternal::Prefetch()const{
+	if (!m_childnodes.empty()){
+		__builtin_prefetch(&*m_childnodes.begin());
 	}
 }
 
-void hwt::HWTInternal::SelectChildNodes(const hw_t &wts, const int radius,
-								   queue<HWTNode*> &next_nodes, int level){
+void hwt::HWTInternal::Summarize(hwsum_t &sum)const{
+	/* children may be shared, so stale summaries are recomputed, not stored */
 	for (auto iter = m_childnodes.begin(); iter != m_childnodes.end(); ++iter){
-		if (wts.distance(iter->first) <= radius){
-			next_nodes.push(iter->second);
+		const hwchild_t &child = iter->second;
+		if (child.stale){
+			child.node->Summarize(sum);
+		} else {
+			sum.Add(child.sum);
 		}
 	}
 }
 
+void hwt::HWTInternal::Refresh(hwsum_t &sum){
+	for (auto iter = m_childnodes.begin(); iter != m_childnodes.end(); ++iter){
+		hwchild_t &child = iter->second;
+		if (child.stale){
+			/* the summary is this node's to store, a shared child is only read */
+			child.sum = hwsum_t();
+			if (child.node->Shared()){
+				child.node->Summarize(child.sum);
+			} else {
+				child.node->Refresh(child.sum);
+			}
+			child.stale = false;
+		}
+		sum.Add(child.sum);
+	}
+}
+
 size_t hwt::HWTInternal::BytesUsed()const{
 	size_t n_elems = m_childnodes.size();
 	size_t n_buckets = m_childnodes.bucket_count();
-	size_t sz_elem = sizeof(unordered_map<hw_t,HWTNode*,hwhasher_t>::value_type);
+	size_t sz_elem = sizeof(hwchildmap_t::value_type);
 	
 	size_t elem_sz = n_elems*(sz_elem + sizeof(void*));
 	size_t tbl_sz = n_buckets*sizeof(void*);
-	return elem_sz + tbl_sz;
+	return sizeof(HWTInternal) + elem_sz + tbl_sz;
 }
 
 bool hwt::HWTInternal::IsLeaf()const{
@@ -111,29 +425,161 @@ bool hwt::HWTInternal::IsLeaf()const{
  *
  **/
 
-hwt::HWTNode* hwt::HWTLeaf::AddEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level){
+#define EVEN_BITS 0x5555555555555555ULL
 
+/* total weight, then weight of the even bits */
+static inline uint16_t leaf_key(const uint64_t code){
+	return (uint16_t)((__builtin_popcountll(code) << 7) | __builtin_popcountll(code & EVEN_BITS));
+}
+
+static bool by_leaf_key(const hwt::hc_t &a, const hwt::hc_t &b){
+	return leaf_key(a.code) < leaf_key(b.code);
+}
+
+/* sort the tail and merge it into the ordered prefix, once the tail is long
+   enough that the amortized cost per entry stays logarithmic */
+void hwt::HWTLeaf::Order(){
+	size_t ntail = m_entries.size() - m_nordered;
+	if (m_entries.size() < LEAF_ORDER_SIZE || ntail <= max((size_t)LC, m_nordered/4)) return;
+
+	if (m_tenants.empty()){
+		sort(m_entries.begin() + m_nordered, m_entries.end(), by_leaf_key);
+		inplace_merge(m_entries.begin(), m_entries.begin() + m_nordered, m_entries.end(), by_leaf_key);
+	} else {
+		/* permute tenant tags along w/ their entries */
+		vector<pair<hc_t, uint32_t>> tagged(m_entries.size());
+		for (size_t i=0;i < m_entries.size();i++){
+			tagged[i] = { m_entries[i], m_tenants[i] };
+		}
+		auto by_key = [](const pair<hc_t,uint32_t> &a, const pair<hc_t,uint32_t> &b){
+			return by_leaf_key(a.first, b.first);
+		};
+		sort(tagged.begin() + m_nordered, tagged.end(), by_key);
+		inplace_merge(tagged.begin(), tagged.begin() + m_nordered, tagged.end(), by_key);
+		for (size_t i=0;i < m_entries.size();i++){
+			m_entries[i] = tagged[i].first;
+			m_tenants[i] = tagged[i].second;
+		}
+	}
+
+	m_keys.resize(m_entries.size());
+	for (size_t i=0;i < m_entries.size();i++){
+		m_keys[i] = leaf_key(m_entries[i].code);
+	}
+	m_nordered = m_entries.size();
+}
+
+hwt::HWTNode* hwt::HWTLeaf::Clone()const{
+	return new HWTLeaf(*this);
+}
+
+hwt::HWTNode* hwt::HWTLeaf::AddEntry(const hc_t &entry, const uint32_t tenant, const hwpyramid_t &pyramid,
+									HWTNode **next, int level){
+
+	if (tenant != 0 || !m_tenants.empty()){
+		m_tenants.resize(m_entries.size(), 0);
+		m_tenants.push_back(tenant);
+	}
 	m_entries.push_back(entry);
 	if (m_entries.size() <= LC || level >= log2(NDIMS)){
+		Order();
 		if (next) *next = NULL;
 		return this;
 	} 
 
 	HWTInternal *internal = new HWTInternal();
 
-	internal->AddEntries(m_entries, level);
+	internal->AddEntries(m_entries, m_tenants, level);
 
-	*next = NULL;
+	if (next) *next = NULL;
 	
 	return internal;
 	
 }
 
-hwt::HWTNode* hwt::HWTLeaf::DelEntry(const hc_t &entry, const hw_t &wts, HWTNode **next, int level){
+hwt::HWTNode* hwt::HWTLeaf::AddBatch(hwbatch_t &batch, const size_t first, const size_t last,
+									const int level){
+
+	if (m_entries.size() + (last - first) <= LC || level >= log2(NDIMS)){
+		if (batch.tenants || !m_tenants.empty()){
+			m_tenants.resize(m_entries.size(), 0);
+			for (size_t i=first;i < last;i++){
+				m_tenants.push_back(batch.Tenant(batch.items[i].pos));
+			}
+		}
+		for (size_t i=first;i < last;i++){
+			m_entries.push_back(batch.entries[batch.items[i].pos]);
+		}
+		Order();
+		return this;
+	}
+
+	HWTInternal *internal = new HWTInternal();
+	if (m_entries.empty()){
+		internal->AddBatch(batch, first, last, level);
+		return internal;
+	}
+
+	/* this leaf's entries join the batch's, whose pyramids are reused */
+	vector<hc_t> entries(m_entries);
+	vector<uint32_t> tenants;
+	if (batch.tenants || !m_tenants.empty()){
+		tenants = m_tenants;
+		tenants.resize(m_entries.size(), 0);
+	}
+	hwbatch_t merged(NULL, NULL);
+	merged.items.reserve(entries.size() + (last - first));
+	for (size_t i=0;i < entries.size();i++){
+		merged.items.emplace_back(entries[i].code, i);
+	}
+	/* the batch's items are in order already, only the leaf's need sorting */
+	sort(merged.items.begin(), merged.items.end(), hwbatch_t::Before);
+	const size_t nleaf = merged.items.size();
+	for (size_t i=first;i < last;i++){
+		const size_t pos = batch.items[i].pos;
+		merged.items.push_back(batch.items[i]);
+		merged.items.back().pos = entries.size();
+		entries.push_back(batch.entries[pos]);
+		if (!tenants.empty()) tenants.push_back(batch.Tenant(pos));
+	}
+	merged.entries = entries.data();
+	merged.tenants = tenants.empty() ? NULL : tenants.data();
+	inplace_merge(merged.items.begin(), merged.items.begin() + nleaf, merged.items.end(), hwbatch_t::Before);
+	internal->AddBatch(merged, 0, entries.size(), level);
+	return internal;
+}
+
+hwt::HWTNode* hwt::HWTLeaf::Merge(HWTNode *other, const int level){
+
+	if (other->IsLeaf()){
+		HWTNode *node = AddEntries(((HWTLeaf*)other)->m_entries, ((HWTLeaf*)other)->m_tenants, level);
+		Release(other);
+		return node;
+	}
+
+	/* other's structure is kept, this leaf's entries go into it */
+	other = Unshare(other);
+	other->AddEntries(m_entries, m_tenants, level);
+	return other;
+}
+
+hwt::HWTNode* hwt::HWTLeaf::DelEntry(const hc_t &entry, const hwpyramid_t &pyramid, HWTNode **next, int level){
 	for (int i=0;i < (int)m_entries.size();i++){
 		if (entry.distance(m_entries[i]) == 0 && entry.id == m_entries[i].id){
-			m_entries[i] = m_entries[m_entries.size()-1];
-			m_entries.pop_back();
+			if (i < (int)m_nordered){
+				/* keep the ordered prefix ordered */
+				m_entries.erase(m_entries.begin() + i);
+				m_keys.erase(m_keys.begin() + i);
+				if (!m_tenants.empty()) m_tenants.erase(m_tenants.begin() + i);
+				m_nordered--;
+			} else {
+				m_entries[i] = m_entries[m_entries.size()-1];
+				m_entries.pop_back();
+				if (!m_tenants.empty()){
+					m_tenants[i] = m_tenants.back();
+					m_tenants.pop_back();
+				}
+			}
 			break;
 		}
 	}
@@ -150,13 +596,114 @@ void hwt::HWTLeaf::GetEntries(vector<hc_t> &entries){
 	}
 }
 
+void hwt::HWTLeaf::GetEntries(vector<hc_t> &entries, vector<uint32_t> &tenants)const{
+	entries.insert(entries.end(), m_entries.begin(), m_entries.end());
+	if (m_tenants.empty()){
+		tenants.resize(tenants.size() + m_entries.size(), 0);
+	} else {
+		tenants.insert(tenants.end(), m_tenants.begin(), m_tenants.end());
+	}
+}
+
 void hwt::HWTLeaf::SelectEntries(const uint64_t target, const int radius, vector<hc_t> &results){
+	static const hwfilter_t nofilter;
+	SelectEntries(target, radius, nofilter, results);
+}
 
-	for (const hc_t &e : m_entries){
-		if (e.distance(target) <= radius){
-			results.push_back(e);
+void hwt::HWTLeaf::SelectEntries(const uint64_t target, const int radius, const hwfilter_t &filter,
+								 vector<hc_t> &results){
+
+	/* for weight w and even-bit weight e, hamming distance to the target is at
+	   least max(|dw|, |2*de - dw|), dw = w - wt and de = e - et; so only visit
+	   the key range that bound allows for each weight in [wt-r, wt+r] */
+	if (m_nordered > 0){
+		const int wt = __builtin_popcountll(target);
+		const int et = __builtin_popcountll(target & EVEN_BITS);
+		for (int w=max(0, wt - radius);w <= min(NDIMS, wt + radius);w++){
+			int dw = w - wt;
+			int lo = et + (int)ceil((dw - radius)/2.0), hi = et + (int)floor((dw + radius)/2.0);
+			lo = max(lo, 0);
+			hi = min(hi, NDIMS/2);
+			if (lo > hi) continue;
+
+			auto first = lower_bound(m_keys.begin(), m_keys.end(), (uint16_t)((w << 7) | lo));
+			auto last = upper_bound(first, m_keys.end(), (uint16_t)((w << 7) | hi));
+			SelectRange(first - m_keys.begin(), last - m_keys.begin(), target, radius, filter, results);
 		}
 	}
+
+	SelectRange(m_nordered, m_entries.size(), target, radius, filter, results);
+}
+
+size_t hwt::HWTLeaf::Ordered()const{
+	return m_nordered;
+}
+
+void hwt::HWTLeaf::GetBands(const uint64_t target, vector<hwband_t> &bands)const{
+	/* the same bound SelectEntries takes the key range from */
+	const int wt = __builtin_popcountll(target);
+	const int et = __builtin_popcountll(target & EVEN_BITS);
+	for (size_t i=0;i < m_nordered;){
+		const uint16_t key = m_keys[i];
+		size_t j = upper_bound(m_keys.begin() + i, m_keys.begin() + m_nordered, key) - m_keys.begin();
+		const int dw = (key >> 7) - wt, de = (key & 0x7f) - et;
+		bands.push_back({ i, j, max(abs(dw), abs(2*de - dw)) });
+		i = j;
+	}
+}
+
+void hwt::HWTLeaf::RankRange(const size_t first, const size_t last, const uint64_t target,
+							 vector<pair<int, hc_t>> &ranked)const{
+	const size_t blocksize = 64;
+	uint8_t dists[blocksize];
+
+	const size_t stride = sizeof(hc_t)/sizeof(uint64_t);
+	for (size_t i=first;i < last;i += blocksize){
+		size_t m = (last - i < blocksize) ? last - i : blocksize;
+		hwt_kernels->distances(&m_entries[i].code, stride, m, target, dists);
+		for (size_t j=0;j < m;j++){
+			ranked.push_back({ dists[j], m_entries[i+j] });
+		}
+	}
+	hc_t::n_query_ops.Add(last - first);
+}
+
+void hwt::HWTLeaf::SelectRange(const size_t first, const size_t last, const uint64_t target, const int radius,
+							   const hwfilter_t &filter, vector<hc_t> &results)const{
+	const size_t blocksize = 64;
+	uint8_t dists[blocksize];
+
+	/* codes sit every other word of the entries */
+	const size_t stride = sizeof(hc_t)/sizeof(uint64_t);
+	for (size_t i=first;i < last;i += blocksize){
+		size_t m = (last - i < blocksize) ? last - i : blocksize;
+		hwt_kernels->distances(&m_entries[i].code, stride, m, target, dists);
+		for (size_t j=0;j < m;j++){
+			if (dists[j] <= radius && filter.Accept(m_entries[i+j].id, m_tenants.empty() ? 0 : m_tenants[i+j])){
+				results.push_back(m_entries[i+j]);
+			}
+		}
+	}
+	hc_t::n_query_ops.Add(last - first);
+}
+
+void hwt::HWTLeaf::Summarize(hwsum_t &sum)const{
+	n_summary_ops.Add(m_entries.size());
+	for (size_t i=0;i < m_entries.size();i++){
+		sum.Add(m_entries[i].code, m_tenants.empty() ? 0 : m_tenants[i]);
+	}
+}
+
+void hwt::HWTLeaf::Refresh(hwsum_t &sum){
+	Summarize(sum);
+}
+
+void hwt::HWTLeaf::Prefetch()const{
+	const char *p = (const char*)m_entries.data();
+	const char *end = (const char*)(m_entries.data() + m_entries.size());
+	for (;p < end;p += 64){
+		__builtin_prefetch(p);
+	}
 }
 
 size_t hwt::HWTLeaf::Size()const{
@@ -164,7 +711,8 @@ size_t hwt::HWTLeaf::Size()const{
 }
 
 size_t hwt::HWTLeaf::BytesUsed()const{
-	return m_entries.capacity()*sizeof(hc_t);
+	return sizeof(HWTLeaf) + m_entries.capacity()*sizeof(hc_t) + m_keys.capacity()*sizeof(uint16_t)
+		+ m_tenants.capacity()*sizeof(uint32_t);
 }
 
 bool hwt::HWTLeaf::IsLeaf()const{
@@ -0,0 +1,164 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#include <algorithm>
+#include "hwt/hwtplanner.hpp"
+
+using namespace std;
+using namespace hwt;
+
+#define L1_WIDTH (NDIMS/2 + 1)
+#define L2_WIDTH (NDIMS/4 + 1)
+
+hwt::HWTPlanner::HWTPlanner(const double threshold){
+	m_threshold = threshold;
+	m_level1.resize(L1_WIDTH*L1_WIDTH, 0);
+	m_level2.resize(L2_WIDTH*L2_WIDTH*L2_WIDTH*L2_WIDTH, 0);
+}
+
+int hwt::HWTPlanner::Level1Index(const uint64_t code){
+	const uint64_t lane = hwpyramid_t(code).lanes[1];
+	return (int)(lane >> 32)*L1_WIDTH + (int)(lane & 0xffffffffULL);
+}
+
+int hwt::HWTPlanner::Level2Index(const uint64_t code){
+	const uint64_t lane = hwpyramid_t(code).lanes[2];
+	int index = 0;
+	for (int i=3;i >= 0;i--){
+		index = index*L2_WIDTH + (int)((lane >> (16*i)) & 0xffffULL);
+	}
+	return index;
+}
+
+void hwt::HWTPlanner::Add(const hc_t &e){
+	m_positions.insert({ e.id, m_codes.size() });
+	m_codes.push_back(e.code);
+	m_ids.push_back(e.id);
+	m_level1[Level1Index(e.code)]++;
+	m_level2[Level2Index(e.code)]++;
+}
+
+void hwt::HWTPlanner::Remove(const hc_t &e){
+	auto range = m_positions.equal_range(e.id);
+	auto iter = range.first;
+	while (iter != range.second && m_codes[iter->second] != e.code) ++iter;
+	if (iter == range.second) return;
+
+	/* move last element into the vacated position */
+	size_t pos = iter->second;
+	size_t last = m_codes.size() - 1;
+	m_positions.erase(iter);
+	if (pos != last){
+		auto moved = m_positions.equal_range(m_ids[last]);
+		for (auto it = moved.first; it != moved.second; ++it){
+			if (it->second == last){
+				it->second = pos;
+				break;
+			}
+		}
+		m_codes[pos] = m_codes[last];
+		m_ids[pos] = m_ids[last];
+	}
+	m_codes.pop_back();
+	m_ids.pop_back();
+
+	m_level1[Level1Index(e.code)]--;
+	m_level2[Level2Index(e.code)]--;
+}
+
+double hwt::HWTPlanner::EstimateLevel1(const uint64_t target, const int radius)const{
+	if (m_codes.empty()) return 0;
+
+	int t = Level1Index(target);
+	int ta = t/L1_WIDTH, tb = t%L1_WIDTH;
+
+	size_t count = 0;
+	for (int a=max(0, ta - radius);a <= min(L1_WIDTH-1, ta + radius);a++){
+		int r = radius - abs(a - ta);
+		for (int b=max(0, tb - r);b <= min(L1_WIDTH-1, tb + r);b++){
+			count += m_level1[a*L1_WIDTH + b];
+		}
+	}
+	return (double)count/(double)m_codes.size();
+}
+
+double hwt::HWTPlanner::EstimateLevel2(const uint64_t target, const int radius)const{
+	if (m_codes.empty()) return 0;
+
+	const uint64_t lane = hwpyramid_t(target).lanes[2];
+	int t[4];
+	for (int i=0;i < 4;i++){
+		t[i] = (int)((lane >> (16*(3-i))) & 0xffffULL);
+	}
+
+	/* visit only the cells inside the L1 ball around the target's key */
+	size_t count = 0;
+	for (int q0=max(0, t[0]-radius);q0 <= min(L2_WIDTH-1, t[0]+radius);q0++){
+		int r0 = radius - abs(q0 - t[0]);
+		for (int q1=max(0, t[1]-r0);q1 <= min(L2_WIDTH-1, t[1]+r0);q1++){
+			int r1 = r0 - abs(q1 - t[1]);
+			for (int q2=max(0, t[2]-r1);q2 <= min(L2_WIDTH-1, t[2]+r1);q2++){
+				int r2 = r1 - abs(q2 - t[2]);
+				int base = ((q0*L2_WIDTH + q1)*L2_WIDTH + q2)*L2_WIDTH;
+				for (int q3=max(0, t[3]-r2);q3 <= min(L2_WIDTH-1, t[3]+r2);q3++){
+					count += m_level2[base + q3];
+				}
+			}
+		}
+	}
+	return (double)count/(double)m_codes.size();
+}
+
+bool hwt::HWTPlanner::PreferScan(const uint64_t target, const int radius)const{
+	if (radius < 0) return false;
+
+	/* level-2 fraction never exceeds level-1, so only refine when needed */
+	if (EstimateLevel1(target, radius) <= m_threshold) return false;
+	return EstimateLevel2(target, radius) > m_threshold;
+}
+
+vector<hc_t> hwt::HWTPlanner::Scan(const uint64_t target, const int radius)const{
+	vector<size_t> positions;
+	scan_codes(m_codes.data(), m_codes.size(), target, radius, positions);
+
+	vector<hc_t> results;
+	results.reserve(positions.size());
+	for (size_t pos : positions){
+		results.push_back({ m_ids[pos], m_codes[pos] });
+	}
+	return results;
+}
+
+size_t hwt::HWTPlanner::Size()const{
+	return m_codes.size();
+}
+
+size_t hwt::HWTPlanner::BytesUsed()const{
+	size_t sz_elem = sizeof(unordered_multimap<long long,size_t>::value_type);
+	return m_codes.capacity()*sizeof(uint64_t) + m_ids.capacity()*sizeof(long long)
+		+ m_positions.size()*(sz_elem + sizeof(void*)) + m_positions.bucket_count()*sizeof(void*)
+		+ (m_level1.capacity() + m_level2.capacity())*sizeof(uint32_t);
+}
+
+void hwt::HWTPlanner::Clear(){
+	m_codes.clear();
+	m_ids.clear();
+	m_positions.clear();
+	fill(m_level1.begin(), m_level1.end(), 0);
+	fill(m_level2.begin(), m_level2.end(), 0);
+}
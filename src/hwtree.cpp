@@ -17,6 +17,7 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
 
 #include <queue>
+#include <stdexcept>
 #include "hwt/hwtree.hpp"
 
 using namespace std;
@@ -24,101 +25,186 @@ using namespace hwt;
 
 hwt::HWTree::HWTree(){
 	m_top = NULL;
+	m_planner = NULL;
+	m_log = NULL;
 }
 
 hwt::HWTree::~HWTree(){
 	Clear();
+	DisablePlanner();
 }
 
-void hwt::HWTree::Insert(const hc_t &e){
+void hwt::HWTree::Insert(const hc_t &e, const uint32_t tenant){
 
+	if (m_log) m_log->Append(LOG_INSERT, e, tenant);
+	if (m_planner) m_planner->Add(e);
+
+	hwpyramid_t pyramid(e.code);
 	if (m_top == NULL){
-		hw_t wts;
 		m_top = new HWTLeaf();
-		m_top->AddEntry(e, wts, NULL, 0);
+		m_top->AddEntry(e, tenant, pyramid, NULL, 0);
 		return;
 	}
 	
+	/* nodes shared w/ a snapshot are copied on the way down */
+	m_top = HWTNode::Unshare(m_top);
+
 	int level = 0;
 	hw_t prev_wts;
 	HWTNode *prev = NULL;
 	HWTNode *current = m_top;
 	while (current != NULL){
-		hw_t current_wts;
-		calc_hwts(current_wts, e.code, level);
-
 		HWTNode *next = NULL;
-		HWTNode *node = current->AddEntry(e, current_wts, &next, level);
-		if (level == 0 && node != current)	{
-			this->m_top = node;
+		HWTNode *node = current->AddEntry(e, tenant, pyramid, &next, level);
+		if (node != current){
+			HWTNode::Release(current);
+			if (prev == NULL){
+				this->m_top = node;
+			} else {
+				prev->SetChildNode(prev_wts, node);
+			}
 		}
 
-		if (node != current && level > 0){
-			delete current;
-			prev->SetChildNode(prev_wts, node);
+		/* next is keyed below the levels current collapsed */
+		if (next != NULL){
+			level += ((HWTInternal*)current)->Skip();
+			pyramid.Level(level, prev_wts);
 		}
-		
 		prev = current;
 		current = next;
-		prev_wts = current_wts;
 		level++;
 	}
 }
 
+void hwt::HWTree::InsertBatch(span<const hc_t> entries, span<const uint32_t> tenants){
+	if (!tenants.empty() && tenants.size() != entries.size()){
+		throw invalid_argument("HWTree: InsertBatch tenants must be empty or parallel to entries");
+	}
+	if (entries.empty()) return;
+
+	for (size_t i=0;i < entries.size();i++){
+		if (m_log) m_log->Append(LOG_INSERT, entries[i], tenants.empty() ? 0 : tenants[i]);
+		if (m_planner) m_planner->Add(entries[i]);
+	}
+
+	if (m_top == NULL) m_top = new HWTLeaf();
+	m_top = HWTNode::Unshare(m_top);
+
+	hwbatch_t batch(entries.data(), tenants.empty() ? NULL : tenants.data(), entries.size());
+	HWTNode *node = m_top->AddBatch(batch, 0, entries.size(), 0);
+	if (node != m_top){
+		HWTNode::Release(m_top);
+		m_top = node;
+	}
+}
+
 void hwt::HWTree::Delete(const hc_t &e){
+	if (m_log) m_log->Append(LOG_DELETE, e);
+	if (m_planner) m_planner->Remove(e);
+
+	m_top = HWTNode::Unshare(m_top);
+
+	hwpyramid_t pyramid(e.code);
 	int level = 0;
 	hw_t prev_wts;
 	HWTNode *prev = NULL;
 	HWTNode *current = m_top;
 
 	while (current != NULL){
-		hw_t current_wts;
-		calc_hwts(current_wts, e.code, level);
-
 		HWTNode *next;
-		HWTNode *node = current->DelEntry(e, current_wts, &next, level);
+		HWTNode *node = current->DelEntry(e, pyramid, &next, level);
 		if (node == NULL){
-			delete current;
-			if (level == 0) {
+			HWTNode::Release(current);
+			if (prev == NULL) {
 				m_top = NULL;
-			}
-			if (level > 0){
+			} else {
 				prev->UnsetChildNode(prev_wts);
 			}
 		}
-		
+
+		if (next != NULL){
+			level += ((HWTInternal*)current)->Skip();
+			pyramid.Level(level, prev_wts);
+		}
 		prev = current;
 		current = next;
-		prev_wts = current_wts;
 		level++;
 	}
 }
 
+void hwt::HWTree::Merge(HWTree &&other){
+	if (this == &other || other.m_top == NULL) return;
+
+	if (m_log || m_planner){
+		vector<hc_t> entries;
+		vector<uint32_t> tenants;
+		other.GetEntries(entries, tenants);
+		for (size_t i=0;i < entries.size();i++){
+			if (m_log) m_log->Append(LOG_INSERT, entries[i], tenants[i]);
+			if (m_planner) m_planner->Add(entries[i]);
+		}
+	}
+
+	if (m_top == NULL){
+		m_top = other.m_top;
+	} else {
+		m_top = HWTNode::Unshare(m_top);
+		HWTNode *node = m_top->Merge(other.m_top, 0);
+		if (node != m_top){
+			HWTNode::Release(m_top);
+			m_top = node;
+		}
+	}
+
+	other.m_top = NULL;
+	if (other.m_planner) other.m_planner->Clear();
+}
+
 vector<hc_t> hwt::HWTree::RangeSearch(const uint64_t target, const int radius)const{
+
+	if (m_planner && m_planner->PreferScan(target, radius)){
+		return m_planner->Scan(target, radius);
+	}
+	return RangeSearch(target, radius, hwfilter_t());
+}
+
+vector<hc_t> hwt::HWTree::RangeSearch(const uint64_t target, const int radius, const hwfilter_t &filter)const{
+
+	/* subtrees w/o the tenant are pruned like those out of range */
+	const uint64_t tenants = filter.TenantMask();
 	vector<hc_t> results;
 
-	queue<HWTNode*> nodes, next_nodes;
+	hw_t target_wts[NLEVELS];
+	hwpyramid_t pyramid(target);
+	for (int level=0;level < NLEVELS;level++){
+		pyramid.Level(level, target_wts[level]);
+	}
+
+	/* nodes w/ their levels, which differ among nodes of one depth once
+	   levels are collapsed */
+	queue<pair<HWTNode*,int>> nodes;
+	vector<HWTNode*> children;
+	if (m_top != NULL) nodes.push({ m_top, 0 });
 
-	if (m_top != NULL) nodes.push(m_top);
-		
-	int level = 0;
 	while (!nodes.empty()){
+		HWTNode *current = nodes.front().first;
+		const int level = nodes.front().second;
+		nodes.pop();
 
-		hw_t target_wts;
-		calc_hwts(target_wts, target, level);
+		if (current->IsLeaf()){
+			((HWTLeaf*)current)->SelectEntries(target, radius, filter, results);
+			continue;
+		}
 
-		while (!nodes.empty()){
-			HWTNode *current = nodes.front();
-			if (current->IsLeaf()){
-				((HWTLeaf*)current)->SelectEntries(target, radius, results);
-			} else {
-				((HWTInternal*)current)->SelectChildNodes(target_wts, radius, next_nodes, level);
-			}
+		HWTInternal *internal = (HWTInternal*)current;
+		if (!internal->PrefixWithin(target_wts, radius, level)) continue;
 
-			nodes.pop();
+		const int keylevel = level + internal->Skip();
+		children.clear();
+		internal->SelectChildNodes(target_wts[keylevel], target, radius, tenants, children);
+		for (HWTNode *child : children){
+			nodes.push({ child, keylevel+1 });
 		}
-		level++;
-		nodes = move(next_nodes);
 	}
 
 	return results;
@@ -126,6 +212,90 @@ vector<hc_t> hwt::HWTree::RangeSearch(const uint64_t target, const int radius)co
 
 
 
+vector<vector<hc_t>> hwt::HWTree::RangeSearchBatch(const vector<uint64_t> &targets, const int radius)const{
+
+	vector<vector<hc_t>> results(targets.size());
+
+	/* pending node of a query, ready once its contents were prefetched */
+	struct step_t {
+		HWTNode *node;
+		int level;
+		bool ready;
+	};
+
+	struct query_t {
+		size_t index;
+		hw_t wts[NLEVELS];
+		vector<step_t> stack;
+	};
+
+	vector<query_t> slots(INTERLEAVE_WIDTH);
+	vector<HWTNode*> children;
+	size_t next = 0;
+	int n_active = 0;
+
+	auto start = [&](query_t &q)->bool{
+		while (next < targets.size()){
+			q.index = next++;
+			const uint64_t target = targets[q.index];
+			if (m_planner && m_planner->PreferScan(target, radius)){
+				results[q.index] = m_planner->Scan(target, radius);
+				continue;
+			}
+			if (m_top == NULL) continue;
+
+			hwpyramid_t pyramid(target);
+			for (int level=0;level < NLEVELS;level++){
+				pyramid.Level(level, q.wts[level]);
+			}
+			__builtin_prefetch(m_top);
+			q.stack.push_back({ m_top, 0, false });
+			return true;
+		}
+		return false;
+	};
+
+	for (query_t &q : slots){
+		if (start(q)) n_active++;
+	}
+
+	while (n_active > 0){
+		for (query_t &q : slots){
+			if (q.stack.empty()) continue;
+
+			step_t &top = q.stack.back();
+			if (!top.ready){
+				/* node itself was prefetched when pushed, now its contents */
+				top.node->Prefetch();
+				top.ready = true;
+				continue;
+			}
+
+			step_t current = top;
+			q.stack.pop_back();
+			const uint64_t target = targets[q.index];
+			if (current.node->IsLeaf()){
+				((HWTLeaf*)current.node)->SelectEntries(target, radius, results[q.index]);
+			} else {
+				HWTInternal *internal = (HWTInternal*)current.node;
+				if (internal->PrefixWithin(q.wts, radius, current.level)){
+					const int keylevel = current.level + internal->Skip();
+					children.clear();
+					internal->SelectChildNodes(q.wts[keylevel], target, radius, ~0ULL, children);
+					for (HWTNode *child : children){
+						__builtin_prefetch(child);
+						q.stack.push_back({ child, keylevel+1, false });
+					}
+				}
+			}
+
+			if (q.stack.empty() && !start(q)) n_active--;
+		}
+	}
+
+	return results;
+}
+
 const size_t hwt::HWTree::Size()const{
 
 	queue<HWTNode*> nodes;
@@ -145,37 +315,69 @@ const size_t hwt::HWTree::Size()const{
 	return n_entries;
 }
 
-const size_t hwt::HWTree::MemoryUsage()const{
-
+void hwt::HWTree::GetEntries(vector<hc_t> &entries, vector<uint32_t> &tenants)const{
 	queue<HWTNode*> nodes;
+	if (m_top != NULL) nodes.push(m_top);
 
+	while (!nodes.empty()){
+		HWTNode *current = nodes.front();
+		if (current->IsLeaf()){
+			((HWTLeaf*)current)->GetEntries(entries, tenants);
+		} else {
+			((HWTInternal*)current)->GetChildNodes(nodes);
+		}
+		nodes.pop();
+	}
+}
+
+void hwt::HWTree::GetEntries(vector<hc_t> &entries)const{
+	queue<HWTNode*> nodes;
 	if (m_top != NULL) nodes.push(m_top);
-	size_t n_bytes = 0;
 
 	while (!nodes.empty()){
 		HWTNode *current = nodes.front();
-		n_bytes += current->BytesUsed();
-		if (!current->IsLeaf()){
+		if (current->IsLeaf()){
+			((HWTLeaf*)current)->GetEntries(entries);
+		} else {
 			((HWTInternal*)current)->GetChildNodes(nodes);
 		}
 		nodes.pop();
 	}
-	return n_bytes + sizeof(HWTree);
 }
 
-void hwt::HWTree::Clear(){
+const size_t hwt::HWTree::MemoryUsage()const{
+
 	queue<HWTNode*> nodes;
-	if (m_top) nodes.push(m_top);
+
+	if (m_top != NULL) nodes.push(m_top);
+	size_t n_bytes = 0;
 
 	while (!nodes.empty()){
 		HWTNode *current = nodes.front();
+		n_bytes += current->BytesUsed();
 		if (!current->IsLeaf()){
 			((HWTInternal*)current)->GetChildNodes(nodes);
 		}
-		delete current;
 		nodes.pop();
 	}
+	if (m_planner) n_bytes += m_planner->BytesUsed() + sizeof(HWTPlanner);
+	return n_bytes + sizeof(HWTree);
+}
+
+void hwt::HWTree::Clear(){
+	/* nodes still held by snapshots outlive the tree */
+	HWTNode::Release(m_top);
 	m_top = NULL;
+	if (m_planner) m_planner->Clear();
+}
+
+shared_ptr<const HWTree> hwt::HWTree::Snapshot()const{
+	shared_ptr<HWTree> snapshot = make_shared<HWTree>();
+	if (m_top){
+		m_top->Ref();
+		snapshot->m_top = m_top;
+	}
+	return snapshot;
 }
 
 void hwt::HWTree::Print(ostream &ostrm)const{
@@ -191,7 +393,9 @@ void hwt::HWTree::Print(ostream &ostrm)const{
 			HWTNode *node = current_nodes.front();
 			if (!node->IsLeaf()){
 				((HWTInternal*)node)->GetChildNodes(next_nodes);
-				ostrm << "(internal-" << level << ")-" << dec << next_nodes.size() << endl; 
+				ostrm << "(internal-" << level << ")-" << dec << next_nodes.size();
+				if (((HWTInternal*)node)->Skip() > 0) ostrm << " skip " << ((HWTInternal*)node)->Skip();
+				ostrm << endl; 
 			} else {
 				HWTLeaf *leaf = (HWTLeaf*)node;
 				ostrm << "(leaf-" << level << ")-" << dec << leaf->Size() << endl;
@@ -212,3 +416,80 @@ void hwt::HWTree::Print(ostream &ostrm)const{
 	ostrm << "------------------------------------" << endl;
 }
 
+void hwt::HWTree::EnablePlanner(const double threshold){
+	DisablePlanner();
+	m_planner = new HWTPlanner(threshold);
+
+	vector<hc_t> entries;
+	GetEntries(entries);
+	for (const hc_t &e : entries){
+		m_planner->Add(e);
+	}
+}
+
+void hwt::HWTree::DisablePlanner(){
+	delete m_planner;
+	m_planner = NULL;
+}
+
+void hwt::HWTree::AttachLog(HWTLog *log){
+	m_log = log;
+}
+
+void hwt::HWTree::Checkpoint(const string &path){
+	uint64_t lsn = 0;
+	if (m_log){
+		m_log->Commit();
+		lsn = m_log->LastLSN();
+	}
+
+	vector<hc_t> entries;
+	vector<uint32_t> tenants;
+	GetEntries(entries, tenants);
+	write_snapshot(path, lsn, entries, tenants);
+
+	/* a crash before this point replays records the snapshot already has;
+	   their lsn's are <= the snapshot's and are skipped */
+	if (m_log) m_log->Truncate();
+}
+
+void hwt::HWTree::Recover(const string &path){
+
+	/* replayed mutations are in the log already */
+	HWTLog *log = m_log;
+	m_log = NULL;
+
+	try {
+		Clear();
+
+		vector<hc_t> entries;
+		vector<uint32_t> tenants;
+		uint64_t lsn = read_snapshot(path, entries, tenants);
+		InsertBatch(entries, tenants);
+
+		if (log){
+			/* runs of inserts go in as one batch, ended by a delete */
+			entries.clear();
+			tenants.clear();
+			log->Replay(lsn, [this, &entries, &tenants](const vector<hwtrecord_t> &batch){
+				for (const hwtrecord_t &rec : batch){
+					hc_t e(rec.id, rec.code);
+					if (rec.op == LOG_INSERT){
+						entries.push_back(e);
+						tenants.push_back(rec.tenant);
+					} else if (rec.op == LOG_DELETE){
+						InsertBatch(entries, tenants);
+						entries.clear();
+						tenants.clear();
+						Delete(e);
+					}
+				}
+			});
+			InsertBatch(entries, tenants);
+		}
+	} catch (...){
+		m_log = log;
+		throw;
+	}
+	m_log = log;
+}
@@ -0,0 +1,142 @@
+/**
+    HWTree - hamming weight indexing tree for 64-bit integer types
+    Copyright (C) 2022  David G. Starkweather
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.  **/
+
+#include <stdexcept>
+#include "hwt/mihindex.hpp"
+
+using namespace std;
+using namespace hwt;
+
+hwt::MIHIndex::MIHIndex(const int nsubs){
+	if (nsubs != 2 && nsubs != 4 && nsubs != 8 && nsubs != 16)
+		throw invalid_argument("MIHIndex: no. substrings must be 2, 4, 8 or 16");
+
+	m_nsubs = nsubs;
+	m_subbits = NDIMS/nsubs;
+	m_submask = (0x01ULL << m_subbits) - 1;
+	m_tables.resize(nsubs);
+}
+
+hwt::MIHIndex::~MIHIndex(){
+	Clear();
+}
+
+uint64_t hwt::MIHIndex::Substring(const uint64_t code, const int i)const{
+	return (code >> (i*m_subbits)) & m_submask;
+}
+
+void hwt::MIHIndex::Insert(const hc_t &e){
+	for (int i=0;i < m_nsubs;i++){
+		m_tables[i][Substring(e.code, i)].push_back(e);
+	}
+}
+
+void hwt::MIHIndex::Delete(const hc_t &e){
+	for (int i=0;i < m_nsubs;i++){
+		auto iter = m_tables[i].find(Substring(e.code, i));
+		if (iter == m_tables[i].end()) continue;
+
+		vector<hc_t> &bucket = iter->second;
+		for (int j=0;j < (int)bucket.size();j++){
+			if (bucket[j] == e){
+				bucket[j] = bucket[bucket.size()-1];
+				bucket.pop_back();
+				break;
+			}
+		}
+		if (bucket.empty()) m_tables[i].erase(iter);
+	}
+}
+
+vector<hc_t> hwt::MIHIndex::RangeSearch(const uint64_t target, const int radius)const{
+	vector<hc_t> results;
+	if (radius < 0) return results;
+
+	/* pigeonhole: some substring lies within subradius of the target's */
+	const int subradius = radius/m_nsubs;
+
+	for (int i=0;i < m_nsubs;i++){
+		const uint64_t sub = Substring(target, i);
+
+		for (int k=0;k <= subradius && k <= m_subbits;k++){
+
+			/* enumerate every k-bit flip mask of the substring (Gosper's hack) */
+			uint64_t flips = (0x01ULL << k) - 1;
+			while (flips <= m_submask){
+
+				auto iter = m_tables[i].find(sub ^ flips);
+				if (iter != m_tables[i].end()){
+					for (const hc_t &e : iter->second){
+						if (e.distance(target) > radius) continue;
+
+						/* report only from the first table that holds it */
+						bool seen = false;
+						for (int j=0;j < i && !seen;j++){
+							seen = __builtin_popcountll(Substring(e.code, j)^Substring(target, j)) <= subradius;
+						}
+						if (!seen) results.push_back(e);
+					}
+				}
+
+				if (flips == 0) break;
+				uint64_t c = flips & -flips;
+				uint64_t r = flips + c;
+				flips = (((r ^ flips) >> 2)/c) | r;
+			}
+		}
+	}
+
+	return results;
+}
+
+const size_t hwt::MIHIndex::Size()const{
+	size_t n_entries = 0;
+	for (auto iter = m_tables[0].begin(); iter != m_tables[0].end(); ++iter){
+		n_entries += iter->second.size();
+	}
+	return n_entries;
+}
+
+const size_t hwt::MIHIndex::MemoryUsage()const{
+	size_t n_bytes = sizeof(MIHIndex);
+	for (const auto &table : m_tables){
+		size_t sz_elem = sizeof(unordered_map<uint64_t,vector<hc_t>>::value_type);
+		n_bytes += table.size()*(sz_elem + sizeof(void*)) + table.bucket_count()*sizeof(void*);
+		for (auto iter = table.begin(); iter != table.end(); ++iter){
+			n_bytes += iter->second.capacity()*sizeof(hc_t);
+		}
+	}
+	return n_bytes;
+}
+
+void hwt::MIHIndex::Clear(){
+	for (auto &table : m_tables){
+		table.clear();
+	}
+}
+
+void hwt::MIHIndex::Print(ostream &ostrm)const{
+	ostrm << "------------MIHIndex----------------" << endl;
+	for (int i=0;i < m_nsubs;i++){
+		ostrm << "(table-" << dec << i << ")-" << m_tables[i].size() << endl;
+		for (auto iter = m_tables[i].begin(); iter != m_tables[i].end(); ++iter){
+			ostrm << "    " << hex << iter->first << " => " << dec << iter->second.size() << endl;
+		}
+	}
+	ostrm << "------------------------------------" << endl;
+}
@@ -0,0 +1,464 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include "hwt/hwtree.hpp"
+
+using namespace std;
+using namespace hwt;
+
+/**
+ * mixed read/write load against one HWTree.
+ *
+ *   loadhwtree [key=value ...]
+ *
+ *   readers=2         no. query threads
+ *   writers=1         no. insert/delete threads
+ *   size=1000000      entries loaded before the run
+ *   seconds=10        run time (ignored w/ trace)
+ *   interval=1        seconds per report line
+ *   mode=snapshot     snapshot: readers search published snapshots, writers
+ *                     publish one every publish= writes; lock: readers and
+ *                     writers share the tree under a writer-first lock
+ *   publish=1000      writes between snapshots
+ *   zipf=1.0          skew of query targets over hot= popular codes (0 uniform)
+ *   hot=10000         no. popular codes
+ *   radii=2:50,6:30,10:20   radius:weight mix of queries
+ *   deletes=0.3       fraction of writes that delete
+ *   trace=path        replay lines "Q code radius", "I id code", "D id code"
+ *                     (codes in hex); all readers+writers threads take ops from one
+ *                     cursor in trace order, so ops on different threads overlap
+ *                     only with their neighbours in flight
+ **/
+
+struct config_t {
+	int readers = 2;
+	int writers = 1;
+	size_t size = 1000000;
+	double seconds = 10;
+	double interval = 1;
+	string mode = "snapshot";
+	int publish = 1000;
+	double zipf = 1.0;
+	size_t hot = 10000;
+	string radii = "2:50,6:30,10:20";
+	double deletes = 0.3;
+	string trace;
+};
+
+/* one trace line */
+struct traceop_t {
+	char op;
+	long long id;
+	uint64_t code;
+	int radius;
+};
+
+/* latencies in nanosecs of one thread over the current interval */
+struct recorder_t {
+	mutex lock;
+	vector<uint32_t> latencies;
+
+	void Record(const chrono::steady_clock::duration d){
+		uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(d).count();
+		lock_guard<mutex> guard(lock);
+		latencies.push_back((uint32_t)min<uint64_t>(ns, UINT32_MAX));
+	}
+
+	void Drain(vector<uint32_t> &out){
+		lock_guard<mutex> guard(lock);
+		out.insert(out.end(), latencies.begin(), latencies.end());
+		latencies.clear();
+	}
+};
+
+/* shared_mutex behind a ticket gate: readers and writers take the shared
+   mutex in arrival order, so a waiting writer holds back the readers after
+   it rather than being starved by them, as glibc's shared_mutex allows */
+struct turnlock_t {
+	mutex gate;
+	condition_variable turned;
+	uint64_t next_ticket = 0;
+	uint64_t serving = 0;
+	shared_mutex rw;
+
+	void Enter(){
+		unique_lock<mutex> guard(gate);
+		const uint64_t ticket = next_ticket++;
+		turned.wait(guard, [&]{ return serving == ticket; });
+	}
+
+	void Leave(){
+		lock_guard<mutex> guard(gate);
+		serving++;
+		turned.notify_all();
+	}
+
+	void lock(){
+		Enter();
+		rw.lock();
+		Leave();
+	}
+
+	void unlock(){
+		rw.unlock();
+	}
+
+	void lock_shared(){
+		Enter();
+		rw.lock_shared();
+		Leave();
+	}
+
+	void unlock_shared(){
+		rw.unlock_shared();
+	}
+};
+
+static HWTree m_tree;
+static turnlock_t m_treelock;
+
+static mutex m_publishlock;
+static shared_ptr<const HWTree> m_published;
+
+static atomic<bool> m_done(false);
+static atomic<long long> m_next_id(1);
+
+static vector<uint64_t> m_hot;
+static vector<double> m_zipf_cdf;
+static vector<pair<int,double>> m_radii;
+
+static vector<traceop_t> m_trace;
+static atomic<size_t> m_next_op(0);
+
+
+static bool parse_args(int argc, char **argv, config_t &cfg){
+	for (int i=1;i < argc;i++){
+		string arg = argv[i];
+		size_t eq = arg.find('=');
+		if (eq == string::npos) return false;
+		string key = arg.substr(0, eq), val = arg.substr(eq+1);
+		if (key == "readers") cfg.readers = atoi(val.c_str());
+		else if (key == "writers") cfg.writers = atoi(val.c_str());
+		else if (key == "size") cfg.size = strtoull(val.c_str(), NULL, 10);
+		else if (key == "seconds") cfg.seconds = atof(val.c_str());
+		else if (key == "interval") cfg.interval = atof(val.c_str());
+		else if (key == "mode") cfg.mode = val;
+		else if (key == "publish") cfg.publish = atoi(val.c_str());
+		else if (key == "zipf") cfg.zipf = atof(val.c_str());
+		else if (key == "hot") cfg.hot = strtoull(val.c_str(), NULL, 10);
+		else if (key == "radii") cfg.radii = val;
+		else if (key == "deletes") cfg.deletes = atof(val.c_str());
+		else if (key == "trace") cfg.trace = val;
+		else return false;
+	}
+	return (cfg.mode == "snapshot" || cfg.mode == "lock") && cfg.readers >= 0 && cfg.writers >= 0
+		&& cfg.publish > 0 && cfg.interval > 0;
+}
+
+static void parse_radii(const string &spec){
+	stringstream ss(spec);
+	string item;
+	double total = 0;
+	while (getline(ss, item, ',')){
+		size_t colon = item.find(':');
+		int radius = atoi(item.substr(0, colon).c_str());
+		double weight = (colon == string::npos) ? 1.0 : atof(item.substr(colon+1).c_str());
+		total += weight;
+		m_radii.push_back({ radius, total });
+	}
+	for (auto &r : m_radii){
+		r.second /= total;
+	}
+}
+
+static bool read_trace(const string &path){
+	ifstream in(path);
+	if (!in) return false;
+	string line;
+	while (getline(in, line)){
+		istringstream ls(line);
+		traceop_t op;
+		ls >> op.op;
+		if (op.op == 'Q'){
+			ls >> hex >> op.code >> dec >> op.radius;
+			if (ls) m_trace.push_back(op);
+		} else if (op.op == 'I' || op.op == 'D'){
+			ls >> op.id >> hex >> op.code;
+			if (ls) m_trace.push_back(op);
+		}
+	}
+	return true;
+}
+
+/* cdf over ranks 1..n of p(k) ~ 1/k^s */
+static void build_zipf(const size_t n, const double s){
+	m_zipf_cdf.resize(n);
+	double total = 0;
+	for (size_t k=0;k < n;k++){
+		total += 1.0/pow((double)(k+1), s);
+		m_zipf_cdf[k] = total;
+	}
+	for (double &p : m_zipf_cdf){
+		p /= total;
+	}
+}
+
+static size_t sample_cdf(const vector<double> &cdf, const double u){
+	return min((size_t)(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), cdf.size()-1);
+}
+
+static size_t rss_bytes(){
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f == NULL) return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(f);
+	return (size_t)resident*(size_t)sysconf(_SC_PAGESIZE);
+}
+
+static vector<hc_t> search(const config_t &cfg, const uint64_t target, const int radius){
+	if (cfg.mode == "lock"){
+		shared_lock<turnlock_t> guard(m_treelock);
+		return m_tree.RangeSearch(target, radius);
+	}
+	shared_ptr<const HWTree> snapshot;
+	{
+		lock_guard<mutex> guard(m_publishlock);
+		snapshot = m_published;
+	}
+	return snapshot->RangeSearch(target, radius);
+}
+
+/* under m_treelock: mutate, and publish a new snapshot every so often */
+static void mutate(const config_t &cfg, const char op, const hc_t &e, int &n_unpublished){
+	unique_lock<turnlock_t> guard(m_treelock);
+	if (op == 'I'){
+		m_tree.Insert(e);
+	} else {
+		m_tree.Delete(e);
+	}
+	if (cfg.mode == "snapshot" && ++n_unpublished >= cfg.publish){
+		shared_ptr<const HWTree> snapshot = m_tree.Snapshot();
+		guard.unlock();
+		lock_guard<mutex> publish(m_publishlock);
+		m_published = snapshot;
+		n_unpublished = 0;
+	}
+}
+
+static void reader(const config_t &cfg, const int index, recorder_t &recorder){
+	mt19937_64 gen(index + 1);
+	uniform_real_distribution<double> unit(0, 1);
+	uniform_int_distribution<int> bitindex(0, 63);
+
+	while (!m_done){
+		/* popular code, nudged off its exact value */
+		uint64_t target = m_hot[sample_cdf(m_zipf_cdf, unit(gen))] ^ (0x01ULL << bitindex(gen));
+		double u = unit(gen);
+		int radius = m_radii[0].first;
+		for (auto &r : m_radii){
+			radius = r.first;
+			if (u <= r.second) break;
+		}
+
+		auto s = chrono::steady_clock::now();
+		vector<hc_t> results = search(cfg, target, radius);
+		recorder.Record(chrono::steady_clock::now() - s);
+	}
+}
+
+static void writer(const config_t &cfg, const int index, vector<hc_t> live, recorder_t &recorder){
+	mt19937_64 gen(1000 + index);
+	uniform_real_distribution<double> unit(0, 1);
+	uniform_int_distribution<uint64_t> distrib(0);
+	int n_unpublished = 0;
+
+	while (!m_done){
+		char op;
+		hc_t e;
+		if (!live.empty() && unit(gen) < cfg.deletes){
+			size_t pos = distrib(gen) % live.size();
+			op = 'D';
+			e = live[pos];
+			live[pos] = live.back();
+			live.pop_back();
+		} else {
+			op = 'I';
+			e = { m_next_id++, distrib(gen) };
+			live.push_back(e);
+		}
+
+		auto s = chrono::steady_clock::now();
+		mutate(cfg, op, e, n_unpublished);
+		recorder.Record(chrono::steady_clock::now() - s);
+	}
+}
+
+/* replay ops in trace order, whether query or mutation */
+static void replayer(const config_t &cfg, recorder_t &read_recorder, recorder_t &write_recorder){
+	int n_unpublished = 0;
+	while (!m_done){
+		size_t i = m_next_op++;
+		if (i >= m_trace.size()) break;
+		const traceop_t &op = m_trace[i];
+		auto s = chrono::steady_clock::now();
+		if (op.op == 'Q'){
+			vector<hc_t> results = search(cfg, op.code, op.radius);
+			read_recorder.Record(chrono::steady_clock::now() - s);
+		} else {
+			mutate(cfg, op.op, { op.id, op.code }, n_unpublished);
+			write_recorder.Record(chrono::steady_clock::now() - s);
+		}
+	}
+}
+
+/* p50, p99, p999 in microsecs */
+static void percentiles(vector<uint32_t> &lat, double p[3]){
+	const double q[3] = { 0.5, 0.99, 0.999 };
+	for (int i=0;i < 3;i++){
+		p[i] = 0;
+		if (lat.empty()) continue;
+		size_t k = min((size_t)(q[i]*lat.size()), lat.size()-1);
+		nth_element(lat.begin(), lat.begin() + k, lat.end());
+		p[i] = lat[k]/1000.0;
+	}
+}
+
+int main(int argc, char **argv){
+
+	config_t cfg;
+	if (!parse_args(argc, argv, cfg)){
+		cout << "usage: " << argv[0] << " [readers=N] [writers=M] [size=N] [seconds=T] [interval=T]"
+			 << " [mode=snapshot|lock] [publish=K] [zipf=S] [hot=N] [radii=r:w,...] [deletes=F] [trace=path]"
+			 << endl;
+		return 1;
+	}
+	parse_radii(cfg.radii);
+	if (!cfg.trace.empty() && !read_trace(cfg.trace)){
+		cout << "cannot read trace " << cfg.trace << endl;
+		return 1;
+	}
+	if (!cfg.trace.empty() && cfg.readers + cfg.writers == 0){
+		cout << "trace replay needs at least one reader or writer" << endl;
+		return 1;
+	}
+
+	cout << "HWTree load: " << cfg.readers << " readers, " << cfg.writers << " writers, mode " << cfg.mode << endl;
+
+	/* initial index, split among writers for them to delete from */
+	mt19937_64 gen(12345);
+	uniform_int_distribution<uint64_t> distrib(0);
+	vector<vector<hc_t>> owned(max(cfg.writers, 1));
+	size_t rss_start = rss_bytes();
+	auto s = chrono::steady_clock::now();
+	for (size_t i=0;i < cfg.size;i++){
+		hc_t e = { m_next_id++, distrib(gen) };
+		m_tree.Insert(e);
+		owned[i % owned.size()].push_back(e);
+		if (m_hot.size() < cfg.hot) m_hot.push_back(e.code);
+	}
+	if (m_hot.empty()) m_hot.push_back(distrib(gen));
+	build_zipf(m_hot.size(), cfg.zipf);
+	m_published = m_tree.Snapshot();
+	chrono::duration<double> loadtime = chrono::steady_clock::now() - s;
+	cout << "loaded " << cfg.size << " entries in " << fixed << setprecision(2) << loadtime.count() << " secs, "
+		 << "index " << m_tree.MemoryUsage()/1000000.0 << "MB, rss +" << (rss_bytes() - rss_start)/1000000.0
+		 << "MB" << endl << endl;
+
+	/* under a trace every thread replays both kinds of op, so each gets both recorders */
+	const int n_replayers = cfg.trace.empty() ? 0 : cfg.readers + cfg.writers;
+	vector<recorder_t> read_recorders(cfg.trace.empty() ? cfg.readers : n_replayers);
+	vector<recorder_t> write_recorders(cfg.trace.empty() ? cfg.writers : n_replayers);
+	vector<thread> threads;
+	for (int i=0;i < n_replayers;i++){
+		threads.emplace_back(replayer, cref(cfg), ref(read_recorders[i]), ref(write_recorders[i]));
+	}
+	for (int i=0;i < cfg.readers && n_replayers == 0;i++){
+		threads.emplace_back(reader, cref(cfg), i, ref(read_recorders[i]));
+	}
+	for (int i=0;i < cfg.writers && n_replayers == 0;i++){
+		threads.emplace_back(writer, cref(cfg), i, owned[i], ref(write_recorders[i]));
+	}
+
+	cout << setw(7) << "secs" << setw(11) << "reads/s" << setw(9) << "p50" << setw(9) << "p99" << setw(9) << "p999"
+		 << setw(11) << "writes/s" << setw(9) << "p50" << setw(9) << "p99" << setw(9) << "p999"
+		 << setw(11) << "entries" << setw(10) << "rss MB" << "   (latency usecs)" << endl;
+
+	/* trace replay runs until the trace is used up */
+	const size_t rss_loaded = rss_bytes();
+	auto start = chrono::steady_clock::now(), last = start;
+	size_t n_reads = 0, n_writes = 0;
+	vector<uint32_t> all_reads, all_writes;
+	while (true){
+		this_thread::sleep_for(chrono::duration<double>(cfg.interval));
+		auto now = chrono::steady_clock::now();
+		double elapsed = chrono::duration<double>(now - start).count();
+		double span = chrono::duration<double>(now - last).count();
+		last = now;
+
+		vector<uint32_t> reads, writes;
+		for (recorder_t &r : read_recorders) r.Drain(reads);
+		for (recorder_t &r : write_recorders) r.Drain(writes);
+		n_reads += reads.size();
+		n_writes += writes.size();
+		all_reads.insert(all_reads.end(), reads.begin(), reads.end());
+		all_writes.insert(all_writes.end(), writes.begin(), writes.end());
+
+		size_t n_entries;
+		{
+			shared_lock<turnlock_t> guard(m_treelock);
+			n_entries = m_tree.Size();
+		}
+
+		double pr[3], pw[3];
+		percentiles(reads, pr);
+		percentiles(writes, pw);
+		cout << setprecision(1) << setw(7) << elapsed << setw(11) << setprecision(0) << reads.size()/span
+			 << setprecision(1) << setw(9) << pr[0] << setw(9) << pr[1] << setw(9) << pr[2]
+			 << setprecision(0) << setw(11) << writes.size()/span
+			 << setprecision(1) << setw(9) << pw[0] << setw(9) << pw[1] << setw(9) << pw[2]
+			 << setw(11) << n_entries << setw(10) << rss_bytes()/1000000.0 << endl;
+
+		bool trace_done = !cfg.trace.empty() && m_next_op >= m_trace.size();
+		if (trace_done || (cfg.trace.empty() && elapsed >= cfg.seconds)) break;
+	}
+	m_done = true;
+	for (thread &t : threads){
+		t.join();
+	}
+	for (recorder_t &r : read_recorders) r.Drain(all_reads);
+	for (recorder_t &r : write_recorders) r.Drain(all_writes);
+	n_reads = all_reads.size();
+	n_writes = all_writes.size();
+
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	double pr[3], pw[3];
+	percentiles(all_reads, pr);
+	percentiles(all_writes, pw);
+	cout << endl << "total: " << setprecision(0) << n_reads/elapsed << " reads/s (p50/p99/p999 "
+		 << setprecision(1) << pr[0] << "/" << pr[1] << "/" << pr[2] << " usecs), "
+		 << setprecision(0) << n_writes/elapsed << " writes/s (p50/p99/p999 "
+		 << setprecision(1) << pw[0] << "/" << pw[1] << "/" << pw[2] << " usecs)" << endl;
+	cout << "memory: index " << setprecision(2) << m_tree.MemoryUsage()/1000000.0 << "MB, rss growth under churn "
+		 << ((double)rss_bytes() - (double)rss_loaded)/1000000.0 << "MB" << endl;
+
+	m_published.reset();
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <cassert>
+#include <ratio>
+#include "hwt/hwtree.hpp"
+#include "hwt/mihindex.hpp"
+
+using namespace std;
+using namespace hwt;
+
+static random_device m_rd;
+static mt19937_64 m_gen(m_rd());
+static uniform_int_distribution<uint64_t> m_distrib(0);
+
+
+static long long m_id = 1;
+static long long g_id = 100000000;
+
+struct perfmetric {
+	double avg_build_time;
+	double avg_query_ops;
+	double avg_query_time;
+	size_t avg_memory_used;
+};
+
+
+int generate_data(vector<hc_t> &entries, const int n){
+
+	for (int i=0;i < n;i++){
+		entries.push_back({ m_id++, m_distrib(m_gen) });
+	}
+
+	return entries.size();
+}
+
+int generate_cluster(vector<hc_t> &entries, const uint64_t center, const int radius, int n){
+	uniform_int_distribution<int> r(1, radius);
+	uniform_int_distribution<int> bitindex(0, 63);
+
+	uint64_t mask = 0x01;
+	entries.push_back({ g_id++, center });
+
+	for (int i=0;i < n-1;i++){
+		uint64_t val = center;
+		if (radius > 0){
+			int dist = r(m_gen);
+			for (int j=0;j < dist;j++){
+				val ^= (mask << bitindex(m_gen));
+			}
+		}
+		entries.push_back({ g_id++, val });
+	}
+	return n;
+}
+
+/* same workload against any index w/ the HWTree interface */
+template<class Index>
+struct perfmetric do_run(Index &index, const vector<hc_t> &entries, const vector<hc_t> &clusters,
+						 const vector<uint64_t> &centers, const int radius){
+	struct perfmetric m;
+
+	auto s = chrono::steady_clock::now();
+	for (const hc_t &e : entries){
+		index.Insert(e);
+	}
+	auto e = chrono::steady_clock::now();
+	chrono::duration<double, nano> buildtime = e - s;
+	for (const hc_t &e : clusters){
+		index.Insert(e);
+	}
+	size_t sz = index.Size();
+	assert(sz == entries.size() + clusters.size());
+
+	m.avg_build_time = buildtime.count()/(double)entries.size();
+	m.avg_memory_used = index.MemoryUsage();
+
+	hc_t::n_query_ops = 0;
+	chrono::duration<double, milli> querytime(0);
+	for (uint64_t center : centers){
+		auto s = chrono::steady_clock::now();
+		vector<hc_t> results = index.RangeSearch(center, radius);
+		auto e = chrono::steady_clock::now();
+		querytime += (e - s);
+		assert(results.size() >= clusters.size()/centers.size());
+	}
+
+	m.avg_query_ops = 100.0*((double)hc_t::n_query_ops/(double)centers.size()/(double)sz);
+	m.avg_query_time = querytime.count()/(double)centers.size();
+
+	index.Clear();
+	return m;
+}
+
+void print_metric(const char *name, const struct perfmetric &m){
+	cout << setw(10) << name << ": build " << setw(10) << setprecision(6) << m.avg_build_time << " nanosecs   "
+		 << "query ops " << setw(10) << setprecision(6) << m.avg_query_ops << "%   "
+		 << "query time " << setw(10) << setprecision(6) << m.avg_query_time << " millisecs   "
+		 << "mem " << fixed << setprecision(2) << (double)m.avg_memory_used/1000000.0 << "MB" << endl;
+	cout.unsetf(ios_base::floatfield);
+}
+
+void do_experiment(const int idx, const int n_entries, const int n_clusters,
+				   const int cluster_size, const int radius, const int nsubs){
+
+	cout << "----------------Trial " << idx << "-------------------------------" << endl;
+	cout << "data set size, N = " << n_entries << "  radius = " << radius << endl;
+
+	m_id = 1;
+	g_id = 100000000;
+
+	vector<hc_t> entries, clusters;
+	vector<uint64_t> centers;
+	generate_data(entries, n_entries);
+	for (int i=0;i < n_clusters;i++){
+		centers.push_back(m_distrib(m_gen));
+		generate_cluster(clusters, centers.back(), radius, cluster_size);
+	}
+
+	HWTree hwtree;
+	print_metric("HWTree", do_run(hwtree, entries, clusters, centers, radius));
+
+	HWTree planned;
+	planned.EnablePlanner();
+	print_metric("+planner", do_run(planned, entries, clusters, centers, radius));
+
+	MIHIndex mih(nsubs);
+	print_metric("MIHIndex", do_run(mih, entries, clusters, centers, radius));
+}
+
+int main(int argc, char **argv){
+
+	const int N = (argc > 1) ? atoi(argv[1]) : 4000000;
+	const int nsubs = (argc > 2) ? atoi(argv[2]) : 4;
+	const int n_clusters = 10;
+	const int cluster_size = 10;
+	const int n_rad = 7;
+	const int rad[n_rad] = { 0, 2, 4, 6, 8, 10, 12 };
+
+	cout << "HWTree vs. MIHIndex (" << nsubs << " substrings)" << endl << endl;
+
+	for (int i=0;i < n_rad;i++){
+		do_experiment(i+1, N, n_clusters, cluster_size, rad[i], nsubs);
+	}
+
+	return 0;
+}
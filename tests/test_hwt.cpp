@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cassert>
 #include <cstdint>
+#include <random>
 #include "hwt/hwt.hpp"
 
 using namespace std;
@@ -35,10 +36,70 @@ void test_hwt(){
 }
 
 
+/* segment weights the slow way: popcount of each segment */
+void reference_hwts(hw_t &hwts, const uint64_t code, const int level){
+	const int width = NDIMS >> level;
+	for (int i=0;i < (1 << level);i++){
+		uint64_t segment = (width == NDIMS) ? code : (code >> (NDIMS - (i+1)*width)) & ((0x01ULL << width) - 1);
+		hwts.wts[i] = (uint8_t)__builtin_popcountll(segment);
+	}
+}
+
+void test_hwpyramid(){
+
+	mt19937_64 gen(4321);
+	uniform_int_distribution<uint64_t> distrib(0);
+
+	for (int i=0;i < 1000;i++){
+		uint64_t code = (i == 0) ? 0xffffffffffffffffULL : distrib(gen);
+		hwpyramid_t pyramid(code);
+		assert(pyramid.lanes[0] == (uint64_t)__builtin_popcountll(code));
+		for (int level=0;level < NLEVELS;level++){
+			hw_t expected, wts, direct;
+			reference_hwts(expected, code, level);
+			pyramid.Level(level, wts);
+			calc_hwts(direct, code, level);
+			assert(wts == expected);
+			assert(direct == expected);
+		}
+	}
+	cout << "hwpyramid_t levels ok" << endl;
+}
+
+void test_hwsum(){
+
+	mt19937_64 gen(1234);
+	uniform_int_distribution<uint64_t> distrib(0);
+	uniform_int_distribution<int> bitindex(0, 63);
+
+	const uint64_t center = distrib(gen);
+	hwsum_t sum;
+	uint64_t codes[8];
+	for (int i=0;i < 8;i++){
+		codes[i] = center ^ (0x01ULL << bitindex(gen)) ^ (0x01ULL << bitindex(gen));
+		sum.Add(codes[i]);
+	}
+
+	for (int i=0;i < 1000;i++){
+		uint64_t target = (i%2) ? distrib(gen) : center ^ (0x01ULL << bitindex(gen));
+		int lb = sum.distance(target);
+		for (int j=0;j < 8;j++){
+			assert(lb <= __builtin_popcountll(codes[j]^target));
+		}
+	}
+
+	hwsum_t one;
+	one.Add(center);
+	assert(one.distance(center) == 0);
+	assert(one.distance(~center) == NDIMS);
+	cout << "hwsum_t bounds ok" << endl;
+}
 
 int main(int argc, char **argv){
 
 	test_hwt();
+	test_hwpyramid();
+	test_hwsum();
 	
 	return 0;
 }
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <cstdint>
+#include <random>
+#include <cassert>
+#include <algorithm>
+#include "hwt/hwtree.hpp"
+#include "hwt/hwtkernels.hpp"
+
+using namespace std;
+using namespace hwt;
+
+static random_device m_rd;
+static mt19937_64 m_gen(m_rd());
+static uniform_int_distribution<uint64_t> m_distrib(0);
+
+/* same answers from every variant this cpu supports */
+int kernels_test(){
+
+	vector<hc_t> entries;
+	for (int i=0;i < 1000;i++){
+		entries.push_back({ i, m_distrib(m_gen) });
+	}
+	vector<uint64_t> codes;
+	for (const hc_t &e : entries){
+		codes.push_back(e.code);
+	}
+
+	HWTree tree;
+	for (const hc_t &e : entries){
+		tree.Insert(e);
+	}
+
+	int n_tested = 0;
+	for (int i=ISA_SCALAR;i < ISA_AUTO;i++){
+		hwtisa_t isa = (hwtisa_t)i;
+		if (!select_isa(isa)){
+			cout << isa_name(isa) << " not supported" << endl;
+			continue;
+		}
+		assert(hwt_kernels->isa == isa);
+		cout << "Test " << isa_name(isa) << " kernels" << endl;
+		n_tested++;
+
+		/* all lengths around the vector widths, strides of plain codes and entries */
+		uint8_t dists[100];
+		for (size_t n=0;n < 40;n++){
+			uint64_t target = m_distrib(m_gen);
+			hwt_kernels->distances(codes.data(), 1, n, target, dists);
+			for (size_t j=0;j < n;j++){
+				assert(dists[j] == __builtin_popcountll(codes[j]^target));
+			}
+			hwt_kernels->distances(&entries[0].code, 2, n, target, dists);
+			for (size_t j=0;j < n;j++){
+				assert(dists[j] == __builtin_popcountll(entries[j].code^target));
+			}
+		}
+		hwt_kernels->distances(codes.data(), 1, 1, ~codes[0], dists);
+		assert(dists[0] == NDIMS);
+		for (size_t j=0;j < 100;j++){
+			assert(entries[j].distance(codes[j+1]) == __builtin_popcountll(codes[j]^codes[j+1]));
+		}
+		assert(entries[0].distance(~codes[0]) == NDIMS);
+
+		for (int j=0;j < 200;j++){
+			hw_t a, b;
+			for (int k=0;k < NDIMS;k++){
+				a.wts[k] = (uint8_t)(m_distrib(m_gen) % 65);
+				b.wts[k] = (uint8_t)(m_distrib(m_gen) % 65);
+			}
+			int expected = 0;
+			for (int k=0;k < NDIMS;k++){
+				expected += abs((int)a.wts[k] - (int)b.wts[k]);
+			}
+			assert(a.l1distance(b) == expected);
+		}
+
+		for (int j=0;j < 20;j++){
+			uint64_t target = (j % 2) ? entries[j].code ^ (0x0fULL << j) : m_distrib(m_gen);
+			int radius = 20 + j;
+			vector<size_t> positions;
+			scan_codes(codes.data(), codes.size(), target, radius, positions);
+			vector<hc_t> results = tree.RangeSearch(target, radius);
+			size_t n_expected = 0;
+			for (size_t k=0;k < codes.size();k++){
+				if (__builtin_popcountll(codes[k]^target) <= radius) n_expected++;
+			}
+			assert(positions.size() == n_expected);
+			assert(results.size() == n_expected);
+		}
+
+		vector<pair<size_t,size_t>> pairs;
+		join_codes(codes.data(), 300, codes.data() + 300, 300, 24, pairs);
+		size_t n_pairs = 0;
+		for (size_t a=0;a < 300;a++){
+			for (size_t b=300;b < 600;b++){
+				if (__builtin_popcountll(codes[a]^codes[b]) <= 24) n_pairs++;
+			}
+		}
+		assert(pairs.size() == n_pairs);
+
+		/* each pair of a code set once, i < j */
+		for (size_t n : { (size_t)0, (size_t)1, (size_t)63, (size_t)64, (size_t)65, (size_t)300 }){
+			pairs.clear();
+			self_join_codes(codes.data(), n, 24, pairs);
+			n_pairs = 0;
+			for (size_t a=0;a < n;a++){
+				for (size_t b=a+1;b < n;b++){
+					if (__builtin_popcountll(codes[a]^codes[b]) <= 24) n_pairs++;
+				}
+			}
+			assert(pairs.size() == n_pairs);
+			for (const pair<size_t,size_t> &p : pairs){
+				assert(p.first < p.second && p.second < n);
+				assert(__builtin_popcountll(codes[p.first]^codes[p.second]) <= 24);
+			}
+		}
+	}
+
+	assert(isa_supported(ISA_SCALAR));
+	assert(n_tested > 0);
+	assert(select_isa(ISA_AUTO));
+	cout << "auto selects " << hwt_kernels->name << endl;
+	return 0;
+}
+
+int main(int argc, char **argv){
+
+	kernels_test();
+
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include "hwt/hwtree.hpp"
+#include "hwt/hwtlog.hpp"
+
+using namespace std;
+using namespace hwt;
+
+const char *snapshot_path = "test_hwtlog.snap";
+const char *log_path = "test_hwtlog.log";
+
+static long long m_id = 1;
+
+static random_device m_rd;
+static mt19937_64 m_gen(m_rd());
+static uniform_int_distribution<uint64_t> m_distrib(0);
+
+
+int generate_data(vector<hc_t> &entries, const int n){
+
+	for (int i=0;i < n;i++){
+		entries.push_back({ m_id++, m_distrib(m_gen) });
+	}
+
+	return entries.size();
+}
+
+bool by_id(const hc_t &a, const hc_t &b){
+	return a.id < b.id;
+}
+
+void check_same(const HWTree &tree, vector<hc_t> expected){
+	vector<hc_t> entries;
+	tree.GetEntries(entries);
+	sort(entries.begin(), entries.end(), by_id);
+	sort(expected.begin(), expected.end(), by_id);
+	assert(entries == expected);
+}
+
+void copy_file(const char *from, const char *to){
+	ifstream src(from, ios::binary);
+	ofstream dst(to, ios::binary|ios::trunc);
+	dst << src.rdbuf();
+}
+
+int recover_test(){
+	remove(snapshot_path);
+	remove(log_path);
+
+	vector<hc_t> entries;
+	generate_data(entries, 3000);
+
+	cout << "Log mutations, checkpoint, log more" << endl;
+	{
+		HWTLog log(log_path, SYNC_NONE, 256);
+		HWTree tree;
+		tree.AttachLog(&log);
+		for (int i=0;i < 2000;i++){
+			tree.Insert(entries[i]);
+		}
+		tree.Checkpoint(snapshot_path);
+		assert(log.LastLSN() == 2000);
+
+		for (int i=2000;i < 3000;i++){
+			tree.Insert(entries[i]);
+		}
+		for (int i=0;i < 100;i++){
+			tree.Delete(entries[i*3]);
+		}
+		/* replay must keep a tail insert, its delete and the reinsert in order */
+		tree.Delete(entries[2999]);
+		tree.Insert(entries[2999]);
+		log.Commit();
+	}
+	for (int i=99;i >= 0;i--){
+		entries.erase(entries.begin() + i*3);
+	}
+
+	cout << "Recover from snapshot + log tail" << endl;
+	{
+		HWTLog log(log_path, SYNC_COMMIT);
+		assert(log.LastLSN() == 3102);
+		HWTree tree;
+		tree.AttachLog(&log);
+		tree.Recover(snapshot_path);
+		assert(tree.Size() == entries.size());
+		check_same(tree, entries);
+
+		/* lsn's continue past the recovered ones */
+		tree.Delete(entries.back());
+		entries.pop_back();
+		assert(log.LastLSN() == 3103);
+	}
+
+	cout << "Recover ignores torn tail" << endl;
+	{
+		ofstream torn(log_path, ios::binary|ios::app);
+		torn << "garbage-partial-record";
+	}
+	{
+		HWTLog log(log_path);
+		HWTree tree;
+		tree.AttachLog(&log);
+		tree.Recover(snapshot_path);
+		check_same(tree, entries);
+
+		/* crash between writing snapshot and truncating the log */
+		log.Commit();
+		copy_file(log_path, "test_hwtlog.log.bak");
+		tree.Checkpoint(snapshot_path);
+	}
+	copy_file("test_hwtlog.log.bak", log_path);
+	{
+		HWTLog log(log_path);
+		HWTree tree;
+		tree.AttachLog(&log);
+		tree.Recover(snapshot_path);
+		assert(tree.Size() == entries.size());
+		check_same(tree, entries);
+	}
+
+	cout << "Recover w/o snapshot replays whole log" << endl;
+	remove(snapshot_path);
+	remove(log_path);
+	{
+		HWTLog log(log_path, SYNC_INTERVAL, 64, 10);
+		HWTree tree;
+		tree.AttachLog(&log);
+		for (const hc_t &e : entries){
+			tree.Insert(e);
+		}
+	}
+	{
+		HWTLog log(log_path);
+		HWTree tree;
+		tree.AttachLog(&log);
+		tree.Recover(snapshot_path);
+		check_same(tree, entries);
+	}
+
+	remove(snapshot_path);
+	remove(log_path);
+	remove("test_hwtlog.log.bak");
+	return 0;
+}
+
+/* filtered searches of tree find the same entries as a scan w/ the tags */
+void check_tenants(const HWTree &tree, const vector<hc_t> &entries, const vector<uint32_t> &tenants){
+	for (uint32_t t=0;t < 4;t++){
+		for (int i=0;i < 5;i++){
+			uint64_t target = entries[i*100].code;
+			vector<hc_t> results = tree.RangeSearch(target, 16, hwfilter_t(t));
+			size_t n_expected = 0;
+			for (size_t j=0;j < entries.size();j++){
+				if (tenants[j] == t && entries[j].distance(target) <= 16) n_expected++;
+			}
+			assert(results.size() == n_expected);
+		}
+	}
+}
+
+int tenant_recover_test(){
+	remove(snapshot_path);
+	remove(log_path);
+
+	vector<hc_t> entries;
+	generate_data(entries, 2000);
+	vector<uint32_t> tenants;
+	for (size_t i=0;i < entries.size();i++){
+		tenants.push_back(i % 4);
+	}
+
+	cout << "Recover keeps tenant tags" << endl;
+	{
+		HWTLog log(log_path, SYNC_NONE);
+		HWTree tree;
+		tree.AttachLog(&log);
+		for (int i=0;i < 1000;i++){
+			tree.Insert(entries[i], tenants[i]);
+		}
+		tree.Checkpoint(snapshot_path);
+
+		/* tail from inserts and from a merged tree */
+		for (int i=1000;i < 1500;i++){
+			tree.Insert(entries[i], tenants[i]);
+		}
+		HWTree delta;
+		for (int i=1500;i < 2000;i++){
+			delta.Insert(entries[i], tenants[i]);
+		}
+		tree.Merge(move(delta));
+		log.Commit();
+	}
+	{
+		HWTLog log(log_path);
+		HWTree tree;
+		tree.AttachLog(&log);
+		tree.Recover(snapshot_path);
+		check_same(tree, entries);
+		check_tenants(tree, entries, tenants);
+	}
+
+	cout << "Reject files of another format" << endl;
+	{
+		ofstream old(log_path, ios::binary|ios::trunc);
+		old << "HWTLOG01-and-some-records";
+	}
+	bool rejected = false;
+	try {
+		HWTLog log(log_path);
+	} catch (const runtime_error &e){
+		rejected = true;
+	}
+	assert(rejected);
+
+	{
+		ofstream old(snapshot_path, ios::binary|ios::trunc);
+		old << "HWTSNAP1-and-some-entries";
+	}
+	vector<hc_t> read;
+	vector<uint32_t> read_tenants;
+	rejected = false;
+	try {
+		read_snapshot(snapshot_path, read, read_tenants);
+	} catch (const runtime_error &e){
+		rejected = true;
+	}
+	assert(rejected);
+
+	remove(snapshot_path);
+	remove(log_path);
+	return 0;
+}
+
+int main(int argc, char **argv){
+
+	recover_test();
+	tenant_recover_test();
+
+	return 0;
+}
@@ -2,7 +2,17 @@
 #include <cstdint>
 #include <random>
 #include <cassert>
+#include <algorithm>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <numeric>
+#include <span>
+#include <stdexcept>
 #include "hwt/hwtree.hpp"
+#include "hwt/hwtcursor.hpp"
 
 using namespace std;
 using namespace hwt;
@@ -48,6 +58,16 @@ int generate_cluster(vector<hc_t> &entries, const uint64_t center, const int n){
 	return n;
 }
 
+/* n random codes, then a cluster of size codes around each of n_clusters
+   random centers */
+void generate_fixture(vector<hc_t> &entries, const int n, uint64_t *centers, const int size){
+	generate_data(entries, n);
+	for (int i=0;i < n_clusters;i++){
+		centers[i] = m_distrib(m_gen);
+		generate_cluster(entries, centers[i], size);
+	}
+}
+
 int basic_test(){
 
 	vector<hc_t> entries;
@@ -117,10 +137,906 @@ int basic_test(){
 	return 0;
 }
 
+void check_results(const HWTree &tree, const vector<hc_t> &entries, const uint64_t target, const int r){
+	vector<hc_t> results = tree.RangeSearch(target, r);
+	size_t n_expected = 0;
+	for (const hc_t &e : entries){
+		if (e.distance(target) <= r) n_expected++;
+	}
+	assert(results.size() == n_expected);
+	for (const hc_t &e : results){
+		assert(e.distance(target) <= r);
+	}
+}
+
+int summary_test(){
+
+	vector<hc_t> entries;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 2000, centers, cluster_size);
+
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+	assert(tree.Size() == entries.size());
+
+	cout << "Compare range search against linear scan" << endl;
+	for (int i=0;i < n_clusters;i++){
+		for (int r=0;r <= 12;r += 2){
+			check_results(tree, entries, centers[i], r);
+		}
+	}
+
+	/* deletes leave stale summaries that later inserts refresh */
+	for (int i=0;i < (int)entries.size()/2;i++){
+		tree.Delete(entries.back());
+		entries.pop_back();
+	}
+	assert(tree.Size() == entries.size());
+	for (int i=0;i < n_clusters;i++){
+		check_results(tree, entries, centers[i], radius);
+	}
+
+	vector<hc_t> more;
+	generate_data(more, 500);
+	for (hc_t &e : more){
+		tree.Insert(e);
+		entries.push_back(e);
+	}
+	assert(tree.Size() == entries.size());
+	for (int i=0;i < n_clusters;i++){
+		check_results(tree, entries, centers[i], radius);
+		check_results(tree, entries, m_distrib(m_gen), 16);
+	}
+	return 0;
+}
+
+int planner_test(){
+
+	vector<hc_t> entries;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 5000, centers, cluster_size);
+
+	HWTree tree;
+	for (int i=0;i < (int)entries.size()/2;i++){
+		tree.Insert(entries[i]);
+	}
+
+	/* planner picks up the entries already in the tree */
+	tree.EnablePlanner();
+	for (int i=(int)entries.size()/2;i < (int)entries.size();i++){
+		tree.Insert(entries[i]);
+	}
+	assert(tree.Size() == entries.size());
+
+	cout << "Compare planned range search against linear scan" << endl;
+	for (int i=0;i < n_clusters;i++){
+		for (int r=0;r <= 16;r += 2){
+			check_results(tree, entries, centers[i], r);
+		}
+	}
+
+	for (int i=0;i < n_clusters;i++){
+		hc_t e = entries[i*7];
+		tree.Delete(e);
+		entries.erase(entries.begin() + i*7);
+	}
+	for (int i=0;i < n_clusters;i++){
+		check_results(tree, entries, centers[i], 4);
+		check_results(tree, entries, m_distrib(m_gen), 20);
+	}
+
+	/* always scan vs. never scan */
+	tree.EnablePlanner(0.0);
+	check_results(tree, entries, centers[0], 8);
+	tree.EnablePlanner(1.0);
+	check_results(tree, entries, centers[0], 8);
+	tree.DisablePlanner();
+	check_results(tree, entries, centers[0], 8);
+	return 0;
+}
+
+int batch_test(){
+
+	vector<hc_t> entries;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 5000, centers, cluster_size);
+
+	vector<uint64_t> targets(centers, centers + n_clusters);
+	for (int i=0;i < 40;i++){
+		targets.push_back(entries[i*100].code);
+	}
+
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+
+	cout << "Compare interleaved batch search against single queries" << endl;
+	for (int r=0;r <= 12;r += 3){
+		vector<vector<hc_t>> results = tree.RangeSearchBatch(targets, r);
+		assert(results.size() == targets.size());
+		for (size_t i=0;i < targets.size();i++){
+			vector<hc_t> expected = tree.RangeSearch(targets[i], r);
+			assert(results[i].size() == expected.size());
+			for (const hc_t &e : expected){
+				assert(find(results[i].begin(), results[i].end(), e) != results[i].end());
+			}
+		}
+	}
+
+	HWTree empty;
+	vector<vector<hc_t>> none = empty.RangeSearchBatch(targets, radius);
+	assert(none.size() == targets.size() && none[0].empty());
+	return 0;
+}
+
+int selfjoin_test(){
+
+	vector<hc_t> entries;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 3000, centers, cluster_size);
+
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+
+	cout << "Compare self join against all pairs" << endl;
+	for (int r : { 0, 4, 10, 20 }){
+		set<pair<long long,long long>> expected;
+		for (size_t i=0;i < entries.size();i++){
+			for (size_t j=i+1;j < entries.size();j++){
+				if (entries[i].distance(entries[j]) <= r){
+					expected.insert(minmax(entries[i].id, entries[j].id));
+				}
+			}
+		}
+
+		for (int n_threads : { 1, 4 }){
+			mutex m;
+			set<pair<long long,long long>> pairs;
+			size_t n_pairs = 0;
+			tree.SelfJoin(r, [&](const hc_t &a, const hc_t &b){
+				assert(a.distance(b) <= r);
+				lock_guard<mutex> lock(m);
+				pairs.insert(minmax(a.id, b.id));
+				n_pairs++;
+			}, n_threads);
+			assert(n_pairs == expected.size());
+			assert(pairs == expected);
+		}
+	}
+	return 0;
+}
+
+int join_test(){
+
+	vector<hc_t> entries, batch;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 3000, centers, cluster_size);
+	generate_data(batch, 300);
+	for (int i=0;i < n_clusters;i++){
+		generate_cluster(batch, centers[i], cluster_size/2);
+	}
+
+	HWTree tree, batchtree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+	for (hc_t &e : batch){
+		batchtree.Insert(e);
+	}
+
+	cout << "Compare join of two trees against all pairs" << endl;
+	for (int r : { 0, 4, 10, 20 }){
+		set<pair<long long,long long>> expected;
+		for (const hc_t &a : batch){
+			for (const hc_t &b : entries){
+				if (a.distance(b) <= r) expected.insert({ a.id, b.id });
+			}
+		}
+
+		for (int n_threads : { 1, 4 }){
+			mutex m;
+			set<pair<long long,long long>> pairs;
+			size_t n_pairs = 0;
+			batchtree.Join(tree, r, [&](const hc_t &a, const hc_t &b){
+				assert(a.distance(b) <= r);
+				lock_guard<mutex> lock(m);
+				pairs.insert({ a.id, b.id });
+				n_pairs++;
+			}, n_threads);
+			assert(n_pairs == expected.size());
+			assert(pairs == expected);
+		}
+	}
+
+	/* small tree still a single leaf */
+	HWTree small;
+	small.Insert(batch[0]);
+	size_t n_pairs = 0;
+	small.Join(tree, 64, [&](const hc_t &a, const hc_t &b){ n_pairs++; }, 1);
+	assert(n_pairs == entries.size());
+	return 0;
+}
+
+int merge_test(){
+
+	vector<hc_t> entries, delta;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 4000, centers, cluster_size);
+	generate_data(delta, 1500);
+	for (int i=0;i < n_clusters;i++){
+		generate_cluster(delta, centers[i], cluster_size);
+	}
+
+	/* more duplicates of one code than a leaf holds */
+	for (int i=0;i < 3*LC;i++){
+		delta.push_back({ g_id++, centers[0] });
+	}
+
+	HWTree tree, deltatree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+	for (hc_t &e : delta){
+		deltatree.Insert(e);
+	}
+
+	cout << "Merge delta tree into tree" << endl;
+	tree.Merge(move(deltatree));
+	assert(deltatree.Size() == 0);
+	entries.insert(entries.end(), delta.begin(), delta.end());
+	assert(tree.Size() == entries.size());
+	for (int i=0;i < n_clusters;i++){
+		for (int r=0;r <= 12;r += 4){
+			check_results(tree, entries, centers[i], r);
+		}
+	}
+
+	/* still updatable after the merge */
+	for (int i=0;i < 100;i++){
+		tree.Delete(entries.back());
+		entries.pop_back();
+	}
+	check_results(tree, entries, centers[1], radius);
+
+	/* leaf root on either side, and an empty target */
+	HWTree small, empty;
+	vector<hc_t> few;
+	generate_data(few, LC/2);
+	for (hc_t &e : few){
+		small.Insert(e);
+	}
+	empty.Merge(move(small));
+	assert(empty.Size() == few.size() && small.Size() == 0);
+
+	tree.Merge(move(empty));
+	entries.insert(entries.end(), few.begin(), few.end());
+	assert(tree.Size() == entries.size());
+	check_results(tree, entries, few[0].code, 8);
+
+	HWTree leafroot;
+	leafroot.Insert(few[0]);
+	leafroot.Merge(move(tree));
+	entries.push_back(few[0]);
+	assert(leafroot.Size() == entries.size());
+	check_results(leafroot, entries, centers[2], radius);
+	return 0;
+}
+
+int snapshot_test(){
+
+	vector<hc_t> entries;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 3000, centers, cluster_size);
+
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+
+	cout << "Snapshot unchanged by later mutations" << endl;
+	shared_ptr<const HWTree> snapshot = tree.Snapshot();
+	const vector<hc_t> frozen = entries;
+	vector<size_t> counts;
+	for (int i=0;i < n_clusters;i++){
+		counts.push_back(snapshot->RangeSearch(centers[i], radius).size());
+	}
+
+	/* reader keeps querying the snapshot while the tree is modified */
+	atomic<bool> done(false);
+	thread reader([&](){
+		while (!done){
+			for (int i=0;i < n_clusters;i++){
+				assert(snapshot->RangeSearch(centers[i], radius).size() == counts[i]);
+			}
+		}
+	});
+
+	vector<hc_t> more;
+	for (int i=0;i < n_clusters;i++){
+		generate_cluster(more, centers[i], cluster_size);
+	}
+	for (hc_t &e : more){
+		tree.Insert(e);
+		entries.push_back(e);
+	}
+	for (int i=0;i < 500;i++){
+		tree.Delete(entries[i]);
+	}
+	entries.erase(entries.begin(), entries.begin() + 500);
+
+	HWTree delta;
+	vector<hc_t> deltas;
+	generate_cluster(deltas, centers[0], 5*LC);
+	for (hc_t &e : deltas){
+		delta.Insert(e);
+	}
+	tree.Merge(move(delta));
+	entries.insert(entries.end(), deltas.begin(), deltas.end());
+
+	done = true;
+	reader.join();
+
+	assert(snapshot->Size() == frozen.size());
+	assert(tree.Size() == entries.size());
+	for (int i=0;i < n_clusters;i++){
+		check_results(*snapshot, frozen, centers[i], radius);
+		check_results(tree, entries, centers[i], radius);
+	}
+
+	/* snapshots of snapshots, and snapshots outliving the tree */
+	shared_ptr<const HWTree> second = tree.Snapshot();
+	tree.Clear();
+	assert(tree.Size() == 0);
+	check_results(*second, entries, centers[1], radius);
+	check_results(*snapshot, frozen, centers[1], radius);
+
+	shared_ptr<const HWTree> third = second->Snapshot();
+	second.reset();
+	check_results(*third, entries, centers[2], radius);
+	return 0;
+}
+
+int churn_test(){
+
+	vector<hc_t> entries;
+	generate_data(entries, 40000);
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+
+	/* summaries left stale by deletes are refreshed once, so an update
+	   rereads about the leaves on its path rather than whole subtrees */
+	cout << "Delete and insert churn" << endl;
+	const int n_ops = 4000;
+	vector<hc_t> more;
+	generate_data(more, n_ops);
+	HWTNode::n_summary_ops = 0;
+	for (hc_t &e : more){
+		tree.Insert(e);
+	}
+	assert(HWTNode::n_summary_ops == 0);
+
+	for (int i=0;i < n_ops;i++){
+		hc_t &e = entries[m_distrib(m_gen) % entries.size()];
+		tree.Delete(e);
+		e = { m_id++, m_distrib(m_gen) };
+		tree.Insert(e);
+	}
+	cout << "summary ops per delete+insert: " << (double)HWTNode::n_summary_ops/n_ops << endl;
+	assert(HWTNode::n_summary_ops < (unsigned long)n_ops*LC);
+
+	entries.insert(entries.end(), more.begin(), more.end());
+	check_results(tree, entries, entries[0].code, radius);
+	return 0;
+}
+
+/* codes sharing one level-5 key: each 2-bit segment of weight one is 01 or 10 */
+uint64_t generate_variant(const uint64_t base){
+	uint64_t code = base;
+	for (int i=0;i < NDIMS;i += 2){
+		uint64_t seg = (base >> i) & 0x03ULL;
+		if ((seg == 0x01ULL || seg == 0x02ULL) && (m_distrib(m_gen) & 0x01ULL)){
+			code ^= (0x03ULL << i);
+		}
+	}
+	return code;
+}
+
+/* variants of a base code, enough to fill ordered leaves, then n random
+   codes; returns the base */
+uint64_t generate_ordered_fixture(vector<hc_t> &entries, const int n){
+	uint64_t base = 0;
+	for (int i=0;i < NDIMS;i += 2){
+		base |= ((m_distrib(m_gen) % 4 == 0) ? 0x03ULL : (0x01ULL << (m_distrib(m_gen) & 0x01ULL))) << i;
+	}
+	for (int i=0;i < 20*LEAF_ORDER_SIZE;i++){
+		entries.push_back({ g_id++, generate_variant(base) });
+	}
+	generate_data(entries, n);
+	return base;
+}
+
+/* base w/ all weight-one segments 01, at the edge of the variants' key range */
+uint64_t extreme_variant(const uint64_t base){
+	uint64_t extreme = base;
+	for (int i=0;i < NDIMS;i += 2){
+		if (((base >> i) & 0x03ULL) == 0x02ULL) extreme ^= (0x03ULL << i);
+	}
+	return extreme;
+}
+
+int ordered_leaf_test(){
+
+	vector<hc_t> entries;
+	const uint64_t base = generate_ordered_fixture(entries, 1000);
+
+	cout << "Search ordered leaves" << endl;
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+	for (int r=0;r <= radius;r += 2){
+		check_results(tree, entries, base, r);
+		check_results(tree, entries, generate_variant(base), r);
+		check_results(tree, entries, base ^ (0x01ULL << m_bitindex(m_gen)), r);
+	}
+
+	/* only variants w/ nearly all weight-one segments 01 fall in the key
+	   range, the rest of the big leaf is skipped */
+	const uint64_t extreme = extreme_variant(base);
+	check_results(tree, entries, extreme, 4);
+	hc_t::n_query_ops = 0;
+	tree.RangeSearch(extreme, 4);
+	assert(hc_t::n_query_ops < 10*LEAF_ORDER_SIZE);
+
+	cout << "Delete from ordered prefix and tail" << endl;
+	for (int i=0;i < 10*LEAF_ORDER_SIZE;i++){
+		tree.Delete(entries[2*i]);
+	}
+	for (int i=10*LEAF_ORDER_SIZE-1;i >= 0;i--){
+		entries.erase(entries.begin() + 2*i);
+	}
+	for (int i=0;i < LEAF_ORDER_SIZE;i++){
+		hc_t e = { g_id++, generate_variant(base) };
+		tree.Insert(e);
+		entries.push_back(e);
+	}
+	assert(tree.Size() == entries.size());
+	for (int r=0;r <= radius;r += 2){
+		check_results(tree, entries, base, r);
+		check_results(tree, entries, generate_variant(base), r);
+	}
+	return 0;
+}
+
+void check_filtered(const HWTree &tree, const vector<hc_t> &entries, const vector<uint32_t> &tenants,
+					const uint64_t target, const int r, const hwfilter_t &filter){
+	vector<hc_t> results = tree.RangeSearch(target, r, filter);
+	set<long long> expected, found;
+	for (size_t i=0;i < entries.size();i++){
+		if (entries[i].distance(target) <= r && filter.Accept(entries[i].id, tenants[i])){
+			expected.insert(entries[i].id);
+		}
+	}
+	for (const hc_t &e : results){
+		found.insert(e.id);
+	}
+	assert(results.size() == found.size());
+	assert(found == expected);
+}
+
+int tenant_test(){
+
+	vector<hc_t> entries;
+	vector<uint32_t> tenants;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 2000, centers, 3*cluster_size);
+	uint64_t base = centers[0];
+	for (int i=0;i < 4*LEAF_ORDER_SIZE;i++){
+		entries.push_back({ g_id++, generate_variant(base) });
+	}
+
+	/* tenants 0-4, a small tenant 70, and 64 sharing tenant 0's summary bit */
+	for (size_t i=0;i < entries.size();i++){
+		tenants.push_back((i % 50 == 0) ? 70 : (i % 77 == 0) ? 64 : (uint32_t)(i % 5));
+	}
+
+	cout << "Filtered search by tenant" << endl;
+	HWTree tree;
+	for (size_t i=0;i < entries.size();i++){
+		tree.Insert(entries[i], tenants[i]);
+	}
+	const uint32_t search_tenants[] = { 0, 3, 64, 70, 99 };
+	for (int i=0;i < n_clusters;i++){
+		for (uint32_t t : search_tenants){
+			check_filtered(tree, entries, tenants, centers[i], radius, hwfilter_t(t));
+		}
+	}
+
+	/* small tenant prunes most subtrees */
+	hc_t::n_query_ops = 0;
+	tree.RangeSearch(centers[1], 2*radius);
+	unsigned long n_all = hc_t::n_query_ops;
+	hc_t::n_query_ops = 0;
+	tree.RangeSearch(centers[1], 2*radius, hwfilter_t(70));
+	assert(hc_t::n_query_ops < n_all);
+
+	cout << "Filtered search by id bitmap" << endl;
+	long long max_id = 0;
+	for (const hc_t &e : entries){
+		max_id = max(max_id, e.id);
+	}
+	vector<uint64_t> idmap(max_id/64 + 1, 0);
+	for (size_t i=0;i < entries.size();i += 3){
+		idmap[entries[i].id/64] |= 0x01ULL << (entries[i].id % 64);
+	}
+	hwfilter_t allow, block, both(2);
+	allow.idmap = &idmap;
+	block.idmap = &idmap;
+	block.blocklist = true;
+	both.idmap = &idmap;
+	for (int i=0;i < n_clusters;i++){
+		check_filtered(tree, entries, tenants, centers[i], radius, allow);
+		check_filtered(tree, entries, tenants, centers[i], radius, block);
+		check_filtered(tree, entries, tenants, centers[i], radius, both);
+	}
+
+	cout << "Tags survive deletes, snapshots and merges" << endl;
+	shared_ptr<const HWTree> snapshot = tree.Snapshot();
+	const vector<hc_t> frozen = entries;
+	const vector<uint32_t> frozen_tenants = tenants;
+	for (int i=0;i < 400;i++){
+		tree.Delete(entries[i]);
+	}
+	entries.erase(entries.begin(), entries.begin() + 400);
+	tenants.erase(tenants.begin(), tenants.begin() + 400);
+
+	HWTree delta;
+	vector<hc_t> more;
+	generate_cluster(more, centers[2], 3*cluster_size);
+	for (size_t i=0;i < more.size();i++){
+		delta.Insert(more[i], 70);
+		entries.push_back(more[i]);
+		tenants.push_back(70);
+	}
+	tree.Merge(move(delta));
+
+	for (int i=0;i < n_clusters;i++){
+		for (uint32_t t : search_tenants){
+			check_filtered(tree, entries, tenants, centers[i], radius, hwfilter_t(t));
+			check_filtered(*snapshot, frozen, frozen_tenants, centers[i], radius, hwfilter_t(t));
+		}
+	}
+	return 0;
+}
+
+/* base w/ the bits of each width-bit segment shuffled: same keys as base
+   at every level whose segments are width bits or wider */
+uint64_t shuffle_segments(const uint64_t base, const int width){
+	const uint64_t mask = (width == NDIMS) ? 0xffffffffffffffffULL : (0x01ULL << width) - 1;
+	vector<int> bits(width);
+	uint64_t code = 0;
+	for (int i=0;i < NDIMS;i += width){
+		iota(bits.begin(), bits.end(), 0);
+		shuffle(bits.begin(), bits.end(), m_gen);
+		int weight = __builtin_popcountll((base >> i) & mask);
+		for (int k=0;k < weight;k++){
+			code |= 0x01ULL << (i + bits[k]);
+		}
+	}
+	return code;
+}
+
+void check_join(const HWTree &a, const HWTree &b, const vector<hc_t> &ea, const vector<hc_t> &eb, const int r){
+	set<pair<long long,long long>> expected, pairs;
+	for (const hc_t &x : ea){
+		for (const hc_t &y : eb){
+			if (x.distance(y) <= r) expected.insert({ x.id, y.id });
+		}
+	}
+	size_t n_pairs = 0;
+	a.Join(b, r, [&](const hc_t &x, const hc_t &y){
+		assert(x.distance(y) <= r);
+		pairs.insert({ x.id, y.id });
+		n_pairs++;
+	}, 1);
+	assert(n_pairs == expected.size());
+	assert(pairs == expected);
+}
+
+int compression_test(){
+
+	/* all codes share their keys at levels 0-2, collapsed into the top node */
+	uint64_t base = m_distrib(m_gen);
+	vector<hc_t> entries;
+	for (int i=0;i < 200;i++){
+		entries.push_back({ g_id++, shuffle_segments(base, 16) });
+	}
+
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+	ostringstream printed;
+	tree.Print(printed);
+	assert(printed.str().find("skip 3") != string::npos);
+
+	cout << "Search collapsed levels" << endl;
+	vector<uint64_t> targets;
+	for (int i=0;i < 10;i++){
+		targets.push_back(shuffle_segments(base, 8));
+		targets.push_back(entries[i].code ^ (0x01ULL << m_bitindex(m_gen)));
+	}
+	targets.push_back(m_distrib(m_gen));
+	for (uint64_t target : targets){
+		for (int r=0;r <= 2*radius;r += 5){
+			check_results(tree, entries, target, r);
+		}
+	}
+	vector<vector<hc_t>> batched = tree.RangeSearchBatch(targets, radius);
+	for (size_t i=0;i < targets.size();i++){
+		assert(batched[i].size() == tree.RangeSearch(targets[i], radius).size());
+	}
+
+	cout << "Expand collapsed levels" << endl;
+	shared_ptr<const HWTree> snapshot = tree.Snapshot();
+	vector<hc_t> frozen = entries;
+	for (int i=0;i < 200;i++){
+		entries.push_back({ g_id++, shuffle_segments(base, 32) });
+		tree.Insert(entries.back());
+	}
+	check_results(tree, entries, base, radius);
+	generate_data(entries, 300);
+	for (size_t i=entries.size()-300;i < entries.size();i++){
+		tree.Insert(entries[i]);
+	}
+	assert(tree.Size() == entries.size());
+	for (uint64_t target : targets){
+		check_results(tree, entries, target, radius);
+		check_results(*snapshot, frozen, target, radius);
+	}
+
+	cout << "Join trees w/ different collapsed levels" << endl;
+	vector<hc_t> deeper;
+	for (int i=0;i < 100;i++){
+		deeper.push_back({ g_id++, shuffle_segments(base, 8) });
+	}
+	HWTree deepertree;
+	for (hc_t &e : deeper){
+		deepertree.Insert(e);
+	}
+	for (int r : { 4, 12 }){
+		check_join(deepertree, tree, deeper, entries, r);
+		check_join(*snapshot, deepertree, frozen, deeper, r);
+	}
+
+	set<pair<long long,long long>> expected, pairs;
+	for (size_t i=0;i < deeper.size();i++){
+		for (size_t j=i+1;j < deeper.size();j++){
+			if (deeper[i].distance(deeper[j]) <= 8) expected.insert(minmax(deeper[i].id, deeper[j].id));
+		}
+	}
+	deepertree.SelfJoin(8, [&](const hc_t &a, const hc_t &b){
+		pairs.insert(minmax(a.id, b.id));
+	}, 1);
+	assert(pairs == expected);
+
+	cout << "Merge trees w/ different collapsed levels" << endl;
+	HWTree other;
+	vector<hc_t> others;
+	uint64_t other_base = shuffle_segments(base, 32);
+	for (int i=0;i < 100;i++){
+		others.push_back({ g_id++, shuffle_segments(other_base, 16) });
+		other.Insert(others.back());
+	}
+	deepertree.Merge(move(other));
+	deeper.insert(deeper.end(), others.begin(), others.end());
+	assert(deepertree.Size() == deeper.size());
+	check_results(deepertree, deeper, base, radius);
+	check_results(deepertree, deeper, other_base, radius);
+
+	tree.Merge(move(deepertree));
+	entries.insert(entries.end(), deeper.begin(), deeper.end());
+	for (uint64_t target : targets){
+		check_results(tree, entries, target, radius);
+	}
+
+	cout << "Delete through collapsed levels" << endl;
+	for (size_t i=0;i < entries.size()/2;i++){
+		tree.Delete(entries[i]);
+	}
+	entries.erase(entries.begin(), entries.begin() + entries.size()/2);
+	assert(tree.Size() == entries.size());
+	for (uint64_t target : targets){
+		check_results(tree, entries, target, radius);
+		check_results(*snapshot, frozen, target, radius);
+	}
+	return 0;
+}
+
+/* page a cursor out to maxradius one radius at a time: each page holds the
+   entries at that distance, and all pages cost one range search's ops */
+void check_cursor_radius(const HWTree &tree, const uint64_t target, const int maxradius){
+	HWTCursor cursor(tree.Snapshot(), target);
+	size_t n_total = 0;
+	unsigned long n_ops = 0;
+	for (int r=0;r <= maxradius;r++){
+		hc_t::n_query_ops = 0;
+		vector<hc_t> results = cursor.NextWithin(r);
+		n_ops += hc_t::n_query_ops;
+		for (const hc_t &e : results){
+			assert(e.distance(target) == r);
+		}
+		n_total += results.size();
+		assert(n_total == tree.RangeSearch(target, r).size());
+		assert(cursor.Bound() > r);
+	}
+	hc_t::n_query_ops = 0;
+	tree.RangeSearch(target, maxradius);
+	assert(n_ops == hc_t::n_query_ops);
+}
+
+int cursor_test(){
+
+	vector<hc_t> entries;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 3000, centers, 5*cluster_size);
+
+	HWTree tree;
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+
+	cout << "Page through cursor results" << endl;
+	for (int i=0;i < n_clusters;i++){
+		const uint64_t target = centers[i] ^ (0x01ULL << m_bitindex(m_gen));
+		vector<int> expected;
+		for (const hc_t &e : entries){
+			expected.push_back(e.distance(target));
+		}
+		sort(expected.begin(), expected.end());
+
+		HWTCursor cursor(tree.Snapshot(), target);
+
+		/* changes after the cursor is opened are not seen */
+		vector<hc_t> more;
+		generate_cluster(more, target, cluster_size);
+		for (hc_t &e : more){
+			tree.Insert(e);
+		}
+
+		set<long long> seen;
+		size_t n_returned = 0;
+		int last = 0;
+		vector<hc_t> page;
+		while (!(page = cursor.Next(25)).empty()){
+			for (const hc_t &e : page){
+				assert(e.distance(target) >= last);
+				assert(e.distance(target) == expected[n_returned]);
+				assert(seen.insert(e.id).second);
+				last = e.distance(target);
+				n_returned++;
+			}
+		}
+		assert(n_returned == entries.size());
+		assert(cursor.Bound() == -1);
+		for (hc_t &e : more){
+			tree.Delete(e);
+		}
+	}
+
+	cout << "Expand cursor radius" << endl;
+	const uint64_t target = centers[0];
+	check_cursor_radius(tree, target, radius);
+
+	/* big leaves, whose key bands are ranked only once in reach */
+	cout << "Expand cursor radius over ordered leaves" << endl;
+	vector<hc_t> ordered;
+	const uint64_t base = generate_ordered_fixture(ordered, 1000);
+	HWTree ordered_tree;
+	for (hc_t &e : ordered){
+		ordered_tree.Insert(e);
+	}
+	check_cursor_radius(ordered_tree, extreme_variant(base), radius);
+	check_cursor_radius(ordered_tree, base, radius);
+
+	HWTCursor empty(HWTree().Snapshot(), target);
+	assert(empty.Next(10).empty() && empty.Bound() == -1);
+	return 0;
+}
+
+int insert_batch_test(){
+
+	vector<hc_t> entries;
+	uint64_t centers[n_clusters];
+	generate_fixture(entries, 5000, centers, 10*cluster_size);
+	/* more duplicates of one code than a leaf holds */
+	for (int i=0;i < 3*LC;i++){
+		entries.push_back({ g_id++, centers[1] });
+	}
+	shuffle(entries.begin(), entries.end(), m_gen);
+
+	cout << "Insert in batches" << endl;
+	HWTree tree, batched;
+	batched.EnablePlanner();
+	for (hc_t &e : entries){
+		tree.Insert(e);
+	}
+	batched.InsertBatch(span<const hc_t>(entries.data(), 500));
+	shared_ptr<const HWTree> snapshot = batched.Snapshot();
+	for (size_t i=500;i < entries.size();i += 1000){
+		batched.InsertBatch(span<const hc_t>(entries).subspan(i, min((size_t)1000, entries.size() - i)));
+	}
+	batched.InsertBatch(span<const hc_t>());
+	assert(batched.Size() == entries.size());
+	assert(snapshot->Size() == 500);
+
+	for (int i=0;i < n_clusters;i++){
+		for (int r=0;r <= radius;r += 5){
+			check_results(batched, entries, centers[i], r);
+			assert(batched.RangeSearch(centers[i], r).size() == tree.RangeSearch(centers[i], r).size());
+		}
+	}
+
+	cout << "Insert tagged batches" << endl;
+	/* an untagged batch first, so that later batches fill leaves w/o tags */
+	HWTree tagged;
+	vector<uint32_t> tenants(entries.size(), 0);
+	tagged.InsertBatch(span<const hc_t>(entries.data(), 500));
+	for (size_t i=500;i < entries.size();i += 1000){
+		const size_t n = min((size_t)1000, entries.size() - i);
+		for (size_t j=i;j < i+n;j++){
+			tenants[j] = (uint32_t)(j % 7);
+		}
+		tagged.InsertBatch(span<const hc_t>(entries).subspan(i, n), span<const uint32_t>(tenants).subspan(i, n));
+	}
+	for (int i=0;i < n_clusters;i++){
+		for (uint32_t t=0;t < 7;t += 3){
+			check_filtered(tagged, entries, tenants, centers[i], radius, hwfilter_t(t));
+		}
+	}
+	bool thrown = false;
+	try {
+		tagged.InsertBatch(span<const hc_t>(entries.data(), 2), span<const uint32_t>(tenants.data(), 1));
+	} catch (const invalid_argument &e){
+		thrown = true;
+	}
+	assert(thrown);
+	assert(tagged.Size() == entries.size());
+
+	/* still updatable one entry at a time */
+	for (int i=0;i < 1000;i++){
+		batched.Delete(entries.back());
+		entries.pop_back();
+	}
+	batched.Insert(entries[0]);
+	entries.push_back(entries[0]);
+	check_results(batched, entries, centers[0], radius);
+	return 0;
+}
 
 int main(int argc, char **argv){
 
 	basic_test();
+	summary_test();
+	planner_test();
+	batch_test();
+	selfjoin_test();
+	join_test();
+	merge_test();
+	snapshot_test();
+	churn_test();
+	ordered_leaf_test();
+	tenant_test();
+	compression_test();
+	cursor_test();
+	insert_batch_test();
 	
 	return 0;
 }
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <cstdint>
+#include <random>
+#include <cassert>
+#include <algorithm>
+#include "hwt/hwtree.hpp"
+#include "hwt/mihindex.hpp"
+
+using namespace std;
+using namespace hwt;
+
+const int n_entries = 5000;
+const int n_clusters = 10;
+const int cluster_size = 10;
+const int max_radius = 12;
+
+static long long m_id = 1;
+static long long g_id = 100000;
+
+static random_device m_rd;
+static mt19937_64 m_gen(m_rd());
+static uniform_int_distribution<uint64_t> m_distrib(0);
+static uniform_int_distribution<int> m_bitindex(0, 63);
+
+
+int generate_data(vector<hc_t> &entries, const int n){
+
+	for (int i=0;i < n;i++){
+		entries.push_back({ m_id++, m_distrib(m_gen) });
+	}
+
+	return entries.size();
+}
+
+int generate_cluster(vector<hc_t> &entries, const uint64_t center, const int radius, const int n){
+	uniform_int_distribution<int> r(1, radius);
+	uint64_t mask = 0x01;
+
+	entries.push_back({ g_id++, center });
+	for (int i=0;i < n-1;i++){
+		uint64_t code_value = center;
+		int d = r(m_gen);
+		for (int j=0;j < d;j++){
+			code_value ^= (mask << m_bitindex(m_gen));
+		}
+		entries.push_back({ g_id++, code_value });
+	}
+	return n;
+}
+
+bool by_id(const hc_t &a, const hc_t &b){
+	return a.id < b.id;
+}
+
+void check_results(const MIHIndex &index, const HWTree &tree, const vector<hc_t> &entries,
+				   const uint64_t target, const int radius){
+	vector<hc_t> results = index.RangeSearch(target, radius);
+	vector<hc_t> expected;
+	for (const hc_t &e : entries){
+		if (e.distance(target) <= radius) expected.push_back(e);
+	}
+
+	sort(results.begin(), results.end(), by_id);
+	sort(expected.begin(), expected.end(), by_id);
+	assert(results == expected);
+
+	vector<hc_t> tree_results = tree.RangeSearch(target, radius);
+	assert(tree_results.size() == results.size());
+}
+
+int mih_test(const int nsubs){
+
+	cout << "MIHIndex w/ " << nsubs << " substrings" << endl;
+
+	vector<hc_t> entries;
+	generate_data(entries, n_entries);
+
+	uint64_t centers[n_clusters];
+	for (int i=0;i < n_clusters;i++){
+		centers[i] = m_distrib(m_gen);
+		generate_cluster(entries, centers[i], 6, cluster_size);
+	}
+
+	MIHIndex index(nsubs);
+	HWTree tree;
+	for (hc_t &e : entries){
+		index.Insert(e);
+		tree.Insert(e);
+	}
+	assert(index.Size() == entries.size());
+
+	for (int i=0;i < n_clusters;i++){
+		for (int r=0;r <= max_radius;r++){
+			check_results(index, tree, entries, centers[i], r);
+		}
+	}
+
+	for (int i=0;i < n_clusters;i++){
+		hc_t e = entries[n_entries + i*cluster_size];
+		index.Delete(e);
+		tree.Delete(e);
+		entries.erase(find(entries.begin(), entries.end(), e));
+		assert(index.Size() == entries.size());
+	}
+
+	for (int i=0;i < n_clusters;i++){
+		check_results(index, tree, entries, centers[i], 0);
+		check_results(index, tree, entries, centers[i], 4);
+		check_results(index, tree, entries, centers[i], 8);
+	}
+
+	cout << "memory used: " << (double)index.MemoryUsage()/1000000.0 << " MB" << endl;
+
+	index.Clear();
+	assert(index.Size() == 0);
+	return 0;
+}
+
+int main(int argc, char **argv){
+
+	mih_test(2);
+	mih_test(4);
+	mih_test(8);
+
+	return 0;
+}